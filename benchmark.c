@@ -0,0 +1,577 @@
+// Benchmarks for the blockchain: hashing, Merkle roots, mining, event ingest,
+// block propagation and synchronization
+// Build: gcc -O2 benchmark.c -o benchmark -lpthread
+// The suite runs several times and every result is the median of its runs (--repeat).
+// The results are one JSON document (stdout or --output FILE), one result per line,
+// so two runs can be compared with --baseline. Everything else goes to stderr.
+#define BLOCKCHAIN_NO_MAIN
+#include "blockchain.c"
+
+/*
+ * BENCHMARK CONFIGURATION
+ */
+
+#define BENCH_FORMAT 1                // Version of the result document
+#define BENCH_MAX_RESULTS 128
+#define BENCH_MAX_REPEATS 15
+#define BENCH_DEFAULT_REPEATS 3       // Runs of the suite, --quick: BENCH_QUICK_REPEATS
+#define BENCH_QUICK_REPEATS 5
+#define BENCH_DEFAULT_TOLERANCE 10.0  // Percent a result may get worse before --baseline reports it
+#define BENCH_QUICK_TOLERANCE 50.0    // Same with --quick: a smoke check, 50 ms measurements drift a lot between processes
+#define BENCH_WAIT_NS 2000000000ull   // Longest wait for a broadcast block to reach every node
+
+// One measurement, compared across runs by benchmark, size and metric
+typedef struct {
+    char benchmark[32];            // What was measured (hash_data, broadcast_block...)
+    char parameter[16];            // What size varies (bytes, events, nodes...)
+    long long size;                // Value of the parameter
+    char metric[24];               // Which number (throughput, latency_p50...)
+    double value;                  // Median of the samples
+    double samples[BENCH_MAX_REPEATS]; // One per run of the suite
+    int sample_count;
+    char unit[16];
+    bool higher_is_better;
+} BenchResult;
+
+BenchResult bench_results[BENCH_MAX_RESULTS];
+int bench_result_count = 0;
+uint64_t bench_budget_ns = 300000000ull; // Minimum time per throughput measurement (--quick: 50 ms)
+bool bench_quick = false;
+int bench_repeats = 0;             // Runs of the suite (--repeat), 0 = the default for the mode
+volatile uint8_t bench_sink;       // Keeps the compiler from dropping the work being timed
+
+// Result with this benchmark, size and metric, NULL if there is none yet
+static BenchResult* bench_find(const char* benchmark, long long size, const char* metric) {
+    for (int i = 0; i < bench_result_count; i++) {
+        BenchResult* r = &bench_results[i];
+        if (!strcmp(r->benchmark, benchmark) && !strcmp(r->metric, metric) && r->size == size) return r;
+    }
+    return NULL;
+}
+
+// Record one sample of a result, the run that measured it adds a sample to the same result
+static void bench_report(const char* benchmark, const char* parameter, long long size,
+                         const char* metric, double value, const char* unit, bool higher_is_better) {
+    BenchResult* result = bench_find(benchmark, size, metric);
+    if (!result) {
+        if (bench_result_count == BENCH_MAX_RESULTS) return;
+        result = &bench_results[bench_result_count++];
+        snprintf(result->benchmark, sizeof(result->benchmark), "%s", benchmark);
+        snprintf(result->parameter, sizeof(result->parameter), "%s", parameter);
+        result->size = size;
+        snprintf(result->metric, sizeof(result->metric), "%s", metric);
+        result->sample_count = 0;
+        snprintf(result->unit, sizeof(result->unit), "%s", unit);
+        result->higher_is_better = higher_is_better;
+    }
+    if (result->sample_count < BENCH_MAX_REPEATS) result->samples[result->sample_count++] = value;
+}
+
+// Ascending order for qsort
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sort every result's samples, take the median and show it with the spread of the runs on stderr
+static void bench_summarize(void) {
+    fprintf(stderr, "Median of %d runs (min .. max)\n", bench_repeats);
+    for (int i = 0; i < bench_result_count; i++) {
+        BenchResult* r = &bench_results[i];
+        qsort(r->samples, r->sample_count, sizeof(double), compare_double);
+        int n = r->sample_count;
+        r->value = n % 2 ? r->samples[n / 2] : (r->samples[n / 2 - 1] + r->samples[n / 2]) / 2;
+        fprintf(stderr, "  %-22s %s=%-8lld %-14s %14.3f %-9s (%.3f .. %.3f)\n", r->benchmark, r->parameter,
+                r->size, r->metric, r->value, r->unit, r->samples[0], r->samples[n - 1]);
+    }
+}
+
+/*
+ * HASHING AND MERKLE BENCHMARKS
+ */
+
+// hash_data throughput for one input size
+static void bench_hash_data(size_t size) {
+    uint8_t* input = malloc(size);
+    for (size_t i = 0; i < size; i++) input[i] = (uint8_t)(i * 131);
+    Digest digest;
+    uint64_t iterations = 0, elapsed;
+    uint64_t start = monotonic_ns();
+    do {
+        for (int i = 0; i < 16; i++) {
+            hash_data(input, size, &digest);
+            input[0] = digest.bytes[0];  // Each hash depends on the one before
+        }
+        iterations += 16;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < bench_budget_ns);
+    bench_sink = digest.bytes[1];
+    bench_report("hash_data", "bytes", (long long)size, "throughput",
+                 (double)size * iterations / (elapsed / 1e9) / 1e6, "MB/s", true);
+    free(input);
+}
+
+// Block header hashes per second: full hash_block, and the midstate path mining uses
+static void bench_hash_block(void) {
+    Digest zero = {{0}};
+    Block* block = create_block(1, &zero);
+    if (!block) return;
+    uint64_t iterations = 0, elapsed;
+    uint64_t start = monotonic_ns();
+    do {
+        for (int i = 0; i < 256; i++) {
+            block->nonce++;
+            hash_block(block);
+        }
+        iterations += 256;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < bench_budget_ns);
+    bench_sink = block->hash.bytes[0];
+    bench_report("hash_block", "bytes", BLOCK_HEADER_SIZE, "rate", iterations / (elapsed / 1e9), "hashes/s", true);
+
+    HashState midstate;
+    hash_block_prefix(block, &midstate);
+    Digest digest;
+    iterations = 0;
+    start = monotonic_ns();
+    do {
+        for (int i = 0; i < 256; i++) hash_block_nonce(&midstate, (int)(iterations + i), &digest);
+        iterations += 256;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < bench_budget_ns);
+    bench_sink = digest.bytes[0];
+    bench_report("hash_block_nonce", "bytes", 4, "rate", iterations / (elapsed / 1e9), "hashes/s", true);
+    free_block(block);
+}
+
+// Merkle root of a block with count events: from scratch (verification) and per appended event (mining)
+static void bench_merkle(int count) {
+    int max_events = chain_params.max_events;
+    chain_params.max_events = count;  // Only for this block, pooled node blocks reserve max_events columns
+    Digest zero = {{0}};
+    Block* block = create_block(1, &zero);
+    if (!block) {
+        chain_params.max_events = max_events;
+        return;
+    }
+    char data[64];
+    for (int i = 0; i < count; i++) {
+        snprintf(data, sizeof(data), "{\"from\":\"bench\",\"to\":\"merkle\",\"amount\":%d}", i);
+        Digest hash;
+        hash_event_fields(1, 0, data, (uint32_t)strlen(data), &hash);
+        block_append_event(block, 1, data, strlen(data), 0, &hash);
+    }
+    chain_params.max_events = max_events;
+
+    uint64_t iterations = 0, elapsed;
+    uint64_t start = monotonic_ns();
+    do {
+        if (!calculate_merkle_root(block)) {
+            fprintf(stderr, "  merkle_root with %d events: out of memory\n", count);
+            free_block(block);
+            return;
+        }
+        iterations++;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < bench_budget_ns);
+    bench_sink = block->merkle_root.bytes[0];
+    bench_report("merkle_root", "events", count, "time", elapsed / 1e3 / iterations, "us", false);
+
+    // The accumulator a block being built keeps, fed the same leaves
+    MerkleAccumulator accumulator;
+    Digest root;
+    iterations = 0;
+    start = monotonic_ns();
+    do {
+        merkle_accumulator_init(&accumulator);
+        for (int i = 0; i < count; i++) merkle_accumulator_append(&accumulator, &block->events.hash[i]);
+        merkle_accumulator_root(&accumulator, &root);
+        iterations++;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < bench_budget_ns);
+    bench_sink = root.bytes[0];
+    bench_report("merkle_append", "events", count, "per_event", (double)elapsed / iterations / count, "ns", false);
+    free_block(block);
+}
+
+/*
+ * MINING AND INGEST BENCHMARKS
+ */
+
+// Proof of Work hash rate of the mining workers, on blocks that need difficulty hashes on average
+static void bench_mining(uint64_t difficulty) {
+    Digest zero = {{0}};
+    Block* block = create_block(1, &zero);
+    if (!block) return;
+    block->bits = bits_from_difficulty(difficulty);
+    unsigned long long hashes = 0;
+    uint64_t elapsed;
+    uint64_t start = monotonic_ns();
+    do {
+        block->index++;  // A new header, so a new nonce search
+        MiningStats stats;
+        mine_block_with_stats(block, &stats);
+        hashes += stats.hashes;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < bench_budget_ns * 2);
+    bench_report("mine_block", "threads", mining_threads ? mining_threads : sysconf(_SC_NPROCESSORS_ONLN),
+                 "hash_rate", hashes / (elapsed / 1e9), "hashes/s", true);
+    free_block(block);
+}
+
+// Events queued per second by add_blockchain_event (batch 1) or add_blockchain_events
+static void bench_ingest(int batch) {
+    enum { ROUND = 512 };  // Events per round, well below what the mempool holds
+    Blockchain* chain = create_blockchain();
+    if (!chain) return;
+    static char payloads[ROUND][64];
+    EventInput inputs[ROUND];
+    for (int i = 0; i < ROUND; i++) {
+        snprintf(payloads[i], sizeof(payloads[i]), "{\"from\":\"bench\",\"to\":\"ingest\",\"amount\":%d}", i);
+        inputs[i].type = 1;
+        inputs[i].data = payloads[i];
+    }
+
+    unsigned long long queued = 0;
+    uint64_t elapsed = 0;
+    while (elapsed < bench_budget_ns) {
+        uint64_t start = monotonic_ns();
+        if (batch == 1) {
+            for (int i = 0; i < ROUND; i++) queued += add_blockchain_event(chain, 1, payloads[i]);
+        } else {
+            for (int i = 0; i < ROUND; i += batch) {
+                queued += add_blockchain_events(chain, inputs + i, ROUND - i < batch ? ROUND - i : batch);
+            }
+        }
+        elapsed += monotonic_ns() - start;
+
+        // Empty the mempool for the next round, not timed
+        mempool_free(&chain->mempool);
+        mempool_init(&chain->mempool);
+    }
+    bench_report(batch == 1 ? "add_blockchain_event" : "add_blockchain_events", "batch", batch,
+                 "rate", queued / (elapsed / 1e9), "events/s", true);
+    free_blockchain(chain);
+}
+
+/*
+ * NETWORK BENCHMARKS
+ * Local nodes (validators, nothing mines on its own) sharing one genesis block
+ */
+
+// Stop and free every node, so the next benchmark starts from an empty registry
+static void bench_stop_nodes(void) {
+    atomic_store(&shutdown_requested, true);
+    for (int i = 0; i < node_count; i++) node_notify(nodes[i], NODE_EVENT_STOP);
+    for (int i = 0; i < active_count; i++) pthread_join(active_nodes[i]->thread, NULL);
+    free_node_registry();
+    atomic_store(&shutdown_requested, false);
+}
+
+// Mine and publish the block after parent, the caller gets the stored block's reference
+static Block* bench_next_block(const Block* parent, uint32_t bits) {
+    Block* block = create_block(parent->index + 1, &parent->hash);
+    if (!block) return NULL;
+    block->bits = bits;
+    mine_block(block);
+    Block* stored = block_publish(block);
+    free_block(block);
+    return stored;
+}
+
+// Whether every node's tip is at height
+static bool bench_all_at(int height) {
+    for (int i = 0; i < node_count; i++) {
+        if (get_chain_tip(nodes[i]->chain).height != height) return false;
+    }
+    return true;
+}
+
+// Time from broadcast_block until every one of count nodes has the block as its tip
+static void bench_broadcast(int count, int blocks) {
+    for (int i = 0; i < count; i++) create_blockchain_node(false, false);
+    Block* parent = block_retain(chain_block_at(nodes[0]->chain, 0));  // Shared genesis, no lock needed yet
+    uint64_t* latency = malloc(blocks * sizeof(uint64_t));
+    int delivered = 0;
+
+    for (int b = 0; b < blocks; b++) {
+        Block* stored = bench_next_block(parent, chain_params.initial_bits);
+        if (!stored) break;
+        uint64_t start = monotonic_ns();
+        broadcast_block(stored, -1);
+        while (!bench_all_at(stored->index) && monotonic_ns() - start < BENCH_WAIT_NS) sched_yield();
+        uint64_t end = monotonic_ns();
+        block_release(parent);
+        parent = stored;
+        if (!bench_all_at(stored->index)) break;  // A node fell behind, the rest would measure its resync
+        latency[delivered++] = end - start;
+    }
+    block_release(parent);
+    bench_stop_nodes();
+
+    if (delivered < blocks) fprintf(stderr, "  broadcast_block with %d nodes: only %d of %d blocks arrived\n",
+                                    count, delivered, blocks);
+    if (delivered == 0) {
+        free(latency);
+        return;
+    }
+    qsort(latency, delivered, sizeof(uint64_t), compare_u64);
+    uint64_t total = 0;
+    for (int i = 0; i < delivered; i++) total += latency[i];
+    bench_report("broadcast_block", "nodes", count, "latency_mean", total / 1e3 / delivered, "us", false);
+    bench_report("broadcast_block", "nodes", count, "latency_p50", latency[delivered / 2] / 1e3, "us", false);
+    // p90 rather than the maximum: one block of the run delayed by the scheduler shouldn't decide the result
+    bench_report("broadcast_block", "nodes", count, "latency_p90", latency[delivered * 9 / 10] / 1e3, "us", false);
+    free(latency);
+}
+
+// Time synchronize_blockchain takes a fresh node to fetch a chain of length blocks
+static void bench_sync(int length) {
+    Node* source = create_blockchain_node(false, false);
+    Blockchain* chain = source->chain;
+    chain_write_lock(chain);
+    for (int h = 1; h < length; h++) {
+        Block* stored = bench_next_block(chain->last_block, chain_next_bits(chain));
+        if (!stored) break;
+        bool appended = append_block(chain, stored) != NULL;
+        block_release(stored);
+        if (!appended) break;
+    }
+    chain_reset_mining_block(chain);
+    pthread_rwlock_unlock(&chain->lock);
+
+    Node* node = create_blockchain_node(false, false);
+    uint64_t start = monotonic_ns();
+    synchronize_blockchain(node);
+    uint64_t elapsed = monotonic_ns() - start;
+    int height = get_chain_tip(node->chain).height;
+    bench_stop_nodes();
+
+    if (height != length - 1) {
+        fprintf(stderr, "  synchronize_blockchain: reached height %d of %d\n", height, length - 1);
+        return;
+    }
+    bench_report("synchronize_blockchain", "blocks", length, "time", elapsed / 1e6, "ms", false);
+    bench_report("synchronize_blockchain", "blocks", length, "per_block", elapsed / 1e3 / length, "us", false);
+}
+
+/*
+ * CHAIN INDEX BENCHMARKS
+ */
+
+// Slots block_index_find looks at per lookup, over every block of a chain mined at difficulty
+// Mined hashes start with zero bytes, so this shows whether the index spreads them out
+// Fixed timestamps and a single mining worker give the same chain, and the same counts, on every run
+static void bench_index(int length, uint64_t difficulty) {
+    Blockchain* chain = create_blockchain();
+    if (!chain) return;
+    uint32_t bits = bits_from_difficulty(difficulty);
+    int threads = mining_threads;
+    mining_threads = 1;
+    chain_write_lock(chain);
+    for (int h = 1; h < length; h++) {
+        const Block* parent = chain->last_block;
+        Block* block = create_block(parent->index + 1, &parent->hash);
+        if (!block) break;
+        block->bits = bits;
+        block->timestamp = parent->timestamp + 1;
+        Block* stored = mine_block(block) ? block_publish(block) : NULL;
+        free_block(block);
+        if (!stored) break;
+        bool appended = append_block(chain, stored) != NULL;
+        block_release(stored);
+        if (!appended) break;
+    }
+
+    const BlockIndex* index = &chain->index;
+    uint64_t total = 0, worst = 0;
+    for (int h = 0; h < chain->block_count; h++) {
+        const Digest* hash = &chain_block_at(chain, h)->hash;
+        uint64_t probes = 1;
+        for (size_t slot = index_slot(hash, index->capacity); !digest_equal(&index->slots[slot].hash, hash);
+             slot = (slot + 1) & (index->capacity - 1)) {
+            probes++;
+        }
+        total += probes;
+        if (probes > worst) worst = probes;
+    }
+    int count = chain->block_count;
+    pthread_rwlock_unlock(&chain->lock);
+    free_blockchain(chain);
+    mining_threads = threads;
+
+    bench_report("block_index_find", "blocks", count, "probes_mean", (double)total / count, "slots", false);
+    bench_report("block_index_find", "blocks", count, "probes_max", (double)worst, "slots", false);
+}
+
+/*
+ * RESULTS
+ */
+
+// Write every result as one JSON document, one result per line (read back by bench_compare)
+static void bench_write_json(FILE* out) {
+    fprintf(out, "{\n  \"suite\": \"blockchain\",\n  \"format\": %d,\n", BENCH_FORMAT);
+    fprintf(out, "  \"block_format\": %d,\n  \"wire_version\": %u,\n", BLOCK_FORMAT_VERSION, WIRE_VERSION);
+    fprintf(out, "  \"hash_kernel\": \"%s\",\n  \"hash_lanes\": %d,\n", hash_lanes_kernel, HASH_LANES);
+    fprintf(out, "  \"timestamp\": %lld,\n  \"cpus\": %ld,\n  \"mining_threads\": %d,\n  \"quick\": %s,\n",
+            (long long)time(NULL), sysconf(_SC_NPROCESSORS_ONLN), mining_threads, bench_quick ? "true" : "false");
+    fprintf(out, "  \"repeats\": %d,\n", bench_repeats);
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < bench_result_count; i++) {
+        const BenchResult* r = &bench_results[i];
+        fprintf(out, "    {\"benchmark\":\"%s\",\"parameter\":\"%s\",\"size\":%lld,\"metric\":\"%s\","
+                     "\"value\":%.6g,\"unit\":\"%s\",\"better\":\"%s\",\"min\":%.6g,\"max\":%.6g}%s\n",
+                r->benchmark, r->parameter, r->size, r->metric, r->value, r->unit,
+                r->higher_is_better ? "higher" : "lower", r->samples[0], r->samples[r->sample_count - 1],
+                i + 1 < bench_result_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Compare with the results of an earlier run (a file written by bench_write_json)
+// A result of the baseline this run doesn't have (a benchmark that failed) counts as a regression
+// Returns the number of results more than tolerance percent worse or missing, -1 if the file can't be read
+static int bench_compare(const char* path, double tolerance) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot read %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int regressions = 0, compared = 0, missing = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        BenchResult old;
+        char better[8];
+        const char* start = strstr(line, "{\"benchmark\"");
+        if (!start || sscanf(start, "{\"benchmark\":\"%31[^\"]\",\"parameter\":\"%15[^\"]\",\"size\":%lld,"
+                                    "\"metric\":\"%23[^\"]\",\"value\":%lf,\"unit\":\"%15[^\"]\",\"better\":\"%7[^\"]\"",
+                             old.benchmark, old.parameter, &old.size, old.metric, &old.value, old.unit, better) != 7) continue;
+
+        const BenchResult* r = bench_find(old.benchmark, old.size, old.metric);
+        if (!r) {
+            missing++;
+            fprintf(stderr, "MISSING %s %s=%lld %s: in the baseline, not measured by this run\n", old.benchmark,
+                    old.parameter, old.size, old.metric);
+            continue;
+        }
+        compared++;
+        if (old.value <= 0) continue;
+        double change = (r->value - old.value) / old.value * 100;  // Percent, positive = bigger
+        double worse = r->higher_is_better ? -change : change;
+        if (worse > tolerance) {
+            regressions++;
+            fprintf(stderr, "REGRESSION %s %s=%lld %s: %.3f -> %.3f %s (%.1f%% worse)\n", r->benchmark,
+                    r->parameter, r->size, r->metric, old.value, r->value, r->unit, worse);
+        }
+    }
+    fclose(file);
+    fprintf(stderr, "Compared %d results with %s: %d regressions beyond %.1f%%, %d missing\n", compared, path,
+            regressions, tolerance, missing);
+    return regressions + missing;
+}
+
+// Every benchmark once, each reports one sample per result
+static void bench_suite(void) {
+    size_t sizes[] = { 64, 1024, 65536 };
+    for (int i = 0; i < 3; i++) bench_hash_data(sizes[i]);
+    bench_hash_block();
+
+    int event_counts[] = { 16, 256, 4096, 65536 };
+    for (int i = 0; i < (bench_quick ? 3 : 4); i++) bench_merkle(event_counts[i]);
+
+    bench_mining(1 << 16);
+    bench_ingest(1);
+    bench_ingest(64);
+
+    int node_counts[] = { 2, 4, 8, 16 };
+    for (int i = 0; i < (bench_quick ? 3 : 4); i++) bench_broadcast(node_counts[i], bench_quick ? 50 : 200);
+    int lengths[] = { 100, 1000, 10000 };
+    for (int i = 0; i < (bench_quick ? 2 : 3); i++) bench_sync(lengths[i]);
+
+    int index_lengths[] = { 100, 1000, 4000 };
+    for (int i = 0; i < (bench_quick ? 2 : 3); i++) bench_index(index_lengths[i], 4096);
+}
+
+int main(int argc, char** argv) {
+    // Command line options
+    //   --quick           shorter measurements and smaller sizes (for CI)
+    //   --threads N       mining workers (default: one per core)
+    //   --output FILE     write the JSON results to FILE instead of stdout
+    //   --repeat N        runs of the suite, each result is the median (default 3, --quick: 5)
+    //   --baseline FILE   compare with an earlier run, exit status 2 if something got worse or is missing
+    //   --tolerance PCT   how much worse a result may be before --baseline reports it (default 10, --quick: 50)
+    const char* output_path = NULL;
+    const char* baseline_path = NULL;
+    double tolerance = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            bench_quick = true;
+            bench_budget_ns = 50000000ull;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            mining_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            bench_repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--quick] [--threads N] [--repeat N] [--output FILE] [--baseline FILE] "
+                            "[--tolerance PCT]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (bench_repeats <= 0) bench_repeats = bench_quick ? BENCH_QUICK_REPEATS : BENCH_DEFAULT_REPEATS;
+    if (bench_repeats > BENCH_MAX_REPEATS) bench_repeats = BENCH_MAX_REPEATS;
+    if (tolerance < 0) tolerance = bench_quick ? BENCH_QUICK_TOLERANCE : BENCH_DEFAULT_TOLERANCE;
+
+    // The nodes print as they go: everything printed goes to stderr, the results keep stdout
+    FILE* json = NULL;
+    if (output_path) {
+        json = fopen(output_path, "w");
+        if (!json) {
+            fprintf(stderr, "Cannot create %s: %s\n", output_path, strerror(errno));
+            return 1;
+        }
+    } else {
+        int fd = dup(STDOUT_FILENO);
+        json = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (!json) return 1;
+    }
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    // Blocks anyone can mine instantly, so the network benchmarks time propagation and not Proof of Work
+    log_blocks = false;
+    chain_params.difficulty = 1;
+    genesis_timestamp = NETWORK_GENESIS_TIME;  // Every node gets the same genesis block
+    if (!chain_params_apply(&chain_params) || !metrics_start()) return 1;
+
+    for (int run = 1; run <= bench_repeats; run++) {
+        fprintf(stderr, "Run %d of %d\n", run, bench_repeats);
+        bench_suite();
+    }
+    bench_summarize();
+    bench_write_json(json);
+    fclose(json);
+
+    int status = 0;
+    if (baseline_path) {
+        int regressions = bench_compare(baseline_path, tolerance);
+        status = regressions < 0 ? 1 : regressions > 0 ? 2 : 0;
+    }
+
+    atomic_store(&shutdown_requested, true);
+    mining_pool_stop();
+    consensus_tracker_free();
+    block_store_free(&block_store);
+    metrics_free();
+    return status;
+}
@@ -5,428 +5,4097 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* 
  * BLOCKCHAIN CONFIGURATION
  */
-#define HASH_SIZE 64                // Length of hash strings
-#define MAX_EVENTS 100              // Maximum events per block( event is transaction or other event like smart contract execution ...)
-#define MAX_NODES 10                // Maximum number of nodes in the network
-#define DIFFICULTY 2                // Number of leading zeros required for Proof of Work
-#define CONSENSUS_THRESHOLD 0.51    // 51% of nodes must agree for consensus
+#define DIGEST_SIZE 32              // Size of a binary hash in bytes (SHA-256)
+#define HASH_SIZE 64                // Length of a hash printed as hex
+// Defaults of the runtime chain parameters (see ChainParams and the command line options)
+#define DEFAULT_MAX_EVENTS 100      // Maximum events per block( event is transaction or other event like smart contract execution ...)
+#define DEFAULT_DIFFICULTY 256      // Expected hashes per block for Proof of Work (256 = two leading zero hex digits)
+#define DEFAULT_CONSENSUS_THRESHOLD 0.51 // 51% of nodes must agree for consensus
+#define DEFAULT_RETARGET_INTERVAL 64 // Blocks between two difficulty retargets (when --block-time is set)
+#define MAX_EVENTS_LIMIT (1 << 20)  // Largest --max-events accepted
+#define NODE_REGISTRY_INITIAL 16    // Initial capacity of the node registry, it grows as needed
+#define MINING_INTERVAL_MS 50       // Pause between two blocks mined by the same node
+#define NETWORK_GENESIS_TIME 1700000000 // Genesis timestamp shared by nodes running as separate processes
 
 /* 
  * CORE DATA STRUCTURES
  */
 
-// Event 
+// Binary hash value, printed in hex only for display
+typedef struct {
+    uint8_t bytes[DIGEST_SIZE];
+} Digest;
+
+// Intermediate state of a hash computation (see hash_init/hash_update/hash_final)
+typedef struct {
+    uint32_t h[8];                 // SHA-256 chaining value
+    uint8_t buffer[64];            // Input bytes waiting for a full 64-byte block
+    size_t buffered;               // Number of bytes in buffer
+    uint64_t length;               // Total number of bytes hashed so far
+} HashState;
+
+// Event - one transaction, as read from a block with get_event
+// Blocks don't store Event structs, see EventColumns
 typedef struct {
     int type;                      // Transaction type (1 = financial transaction, 2- any other kind of events)
-    char data[256];                // JSON-formatted transaction data
-    char timestamp[30];            // When the transaction was created
-    char hash[HASH_SIZE+1];        // Unique identifier for this transaction
+    const char* data;              // JSON-formatted transaction data (NUL terminated, any length)
+    uint32_t data_length;          // Length of data in bytes
+    time_t timestamp;              // When the transaction was created
+    Digest hash;                   // Unique identifier for this transaction
     bool is_valid;                 // Validation status flag
 } Event;
 
-// Merkle Tree Node - Used to efficiently validate transaction integrity
-typedef struct MerkleNode {
-    char hash[HASH_SIZE+1];        // Hash value at this node
-    struct MerkleNode* left;       // Left child (if any)
-    struct MerkleNode* right;      // Right child (if any)
-} MerkleNode;
+// Events of a block in structure-of-arrays form
+// The fields validation and Merkle building touch are dense arrays, one entry per event,
+// and the variable-length payloads are packed in a separate byte arena
+typedef struct {
+    Digest* hash;                  // Event hashes (the Merkle leaves), start of the column allocation
+    int64_t* timestamp;            // Creation times, seconds since the epoch
+    int* type;                     // Transaction types
+    bool* is_valid;                // Validation status flags
+    uint32_t* data_offset;         // Where each payload starts in data
+    uint32_t* data_length;         // Payload lengths, without the terminating NUL
+    char* data;                    // Payload arena
+    size_t data_used;              // Bytes of the payload arena in use
+    size_t data_capacity;          // Bytes allocated for the payload arena
+} EventColumns;
+
+// Merkle Tree - Used to efficiently validate transaction integrity
+// Stored as one flat array, level 0 holds the leaves and the last level holds the root
+#define MERKLE_MAX_LEVELS 32
+typedef struct {
+    Digest* nodes;                 // All levels back to back
+    int leaf_count;                // Number of leaves (events)
+    int level_count;               // Number of levels including leaves and root
+    int level_offset[MERKLE_MAX_LEVELS]; // Index in nodes of the first hash of each level
+    int level_size[MERKLE_MAX_LEVELS];   // Number of hashes in each level
+} MerkleTree;
+
+// Merkle inclusion proof - the sibling hashes on the path from one leaf to the root
+// Lets a client check that an event is in a block with O(log n) hashes instead of all events
+typedef struct {
+    int leaf_index;                // Position of the event in the block
+    int leaf_count;                // Number of events in the block
+    int length;                    // Number of sibling hashes (tree height)
+    Digest siblings[MERKLE_MAX_LEVELS]; // siblings[l] is the neighbour of the path at level l
+} MerkleProof;
+
+// Append-only Merkle accumulator - the right edge ("frontier") of the tree
+// If bit l of count is set, frontier[l] is the root of a complete subtree of 2^l leaves
+typedef struct {
+    Digest frontier[MERKLE_MAX_LEVELS];
+    uint32_t count;                // Number of leaves appended so far
+} MerkleAccumulator;
 
 // Block - A container for multiple events/transactions
 typedef struct Block {
     int index;                     // Position in the blockchain (0 = genesis block)
     time_t timestamp;              // When the block was created
-    char previous_hash[HASH_SIZE+1]; // Hash of the previous block (forms the chain)
-    Event* events;                 // Array of events contained in this block
+    Digest previous_hash;          // Hash of the previous block (forms the chain)
+    EventColumns events;           // Events contained in this block (structure of arrays)
     int event_count;               // Number of events currently in the block
     int event_capacity;            // Maximum events this block can hold before resizing
     int nonce;                     // Number used once for Proof of Work
-    char merkle_root[HASH_SIZE+1]; // Root hash of the Merkle tree of all events
-    char hash[HASH_SIZE+1];        // Hash of this entire block, Prevents needing to recalculate the hash every time it's needed
+    uint32_t bits;                 // Compact target the block hash must meet (see target_from_bits)
+    Digest merkle_root;            // Root hash of the Merkle tree of all events
+    MerkleAccumulator* merkle;     // Incremental Merkle state while the block is being built (NULL once stored)
+    Digest hash;                   // Hash of this entire block, Prevents needing to recalculate the hash every time it's needed
     // also so that it Contains the result of the mining process (the valid hash that meets difficulty requirements)
-    struct Block* next;            // Pointer to the next block in the chain
+    atomic_int refs;               // References held on a stored (shared, immutable) block
+    struct StoreSegment* segment;  // Store segment holding the block, NULL for working blocks
 } Block;
 
+// Spare working blocks of a chain, so mining and decoding reuse their buffers (see BLOCK POOL)
+#define POOL_SPARE_BLOCKS 4
+typedef struct {
+    pthread_mutex_t lock;
+    Block* spares[POOL_SPARE_BLOCKS]; // Emptied blocks, their buffers still allocated
+    int spare_count;
+    unsigned long long allocated;  // Blocks taken from the heap because no spare was left
+    unsigned long long reused;     // Blocks served from the spares
+    unsigned long long recycled;   // Blocks given back and kept as spares
+    unsigned long long freed;      // Blocks given back to the heap (no room, or a huge arena)
+} BlockPool;
+
+// Chunk of a store segment's event arena (event columns and payloads)
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;       // Older chunk of the same segment
+    size_t used;                   // Bytes handed out from this chunk
+    size_t capacity;               // Bytes that fit in this chunk
+    uint8_t bytes[];
+} ArenaChunk;
+
+// Store segment - block headers side by side, their events in the segment's arena
+#define STORE_SEGMENT_BLOCKS 256   // Block headers per segment
+typedef struct StoreSegment {
+    Block blocks[STORE_SEGMENT_BLOCKS]; // Headers, in the order they were stored
+    ArenaChunk* arena;             // Event arena, newest chunk first
+    int used;                      // Slots handed out so far
+    int live;                      // Blocks in this segment that are still referenced
+    int position;                  // Index in the store's segment array
+    struct StoreSegment* retired_next; // Next segment waiting for tip readers to leave
+} StoreSegment;
+
+// Block store - where confirmed blocks live, shared by every node (see BLOCK STORE)
+typedef struct {
+    StoreSegment** segments;       // Segments are never moved, freed ones leave a NULL
+    int segment_count;
+    int segment_capacity;
+    long live_blocks;              // Blocks currently referenced by at least one chain
+    long total_blocks;             // Blocks ever published
+    StoreSegment* retired;         // Dead segments not freed yet because tip readers were active
+    atomic_int tip_readers;        // Threads currently inside chain_tip_acquire/get_chain_tip
+    pthread_mutex_t lock;          // Protects segments, the retired list and the counters
+} BlockStore;
+
+// Cumulative proof of work of the chain ending with a block, in expected hashes (see block_work)
+typedef unsigned __int128 ChainWork;
+
+// Entry of a block hash table
+typedef struct {
+    Digest hash;                   // Key: block hash
+    Block* block;                  // Value, NULL for an empty slot
+    ChainWork work;                // Cumulative work up to and including this block
+} BlockIndexEntry;
+
+// Open addressing hash table: block hash -> block and its cumulative work (see CHAIN INDEX)
+typedef struct {
+    BlockIndexEntry* slots;
+    size_t capacity;               // Number of slots (power of two)
+    size_t count;                  // Number of used slots
+} BlockIndex;
+
+// Which nodes hold a block on their main chain (see CONSENSUS TRACKER)
+typedef struct {
+    Digest hash;                   // Key: block hash
+    uint64_t* holders;             // Bitset of node ids, NULL for an empty slot
+    int words;                     // Allocated 64-bit words of holders
+    int count;                     // Number of holders
+    int height;                    // Height of the block
+    bool finalized;                // Reached the consensus threshold, counted in consensus.finalized
+} ConsensusEntry;
+
+// Block that reached the consensus threshold, waiting in the tracker until it is delivered
+typedef struct {
+    Digest hash;
+    int height;
+    int holders;                   // Chains holding it when it got there
+    int members;                   // Chains counted at that moment
+} FinalizedBlock;
+
+// Block hash -> holders, shared by every chain of this process
+typedef struct {
+    pthread_mutex_t lock;          // Taken inside a chain->lock, see lock order
+    ConsensusEntry* slots;         // Open addressing hash table
+    size_t capacity;               // Number of slots (power of two), 0 until the first block
+    size_t count;                  // Number of used slots
+    int members;                   // Chains counted, one per active node
+    unsigned long long finalized;  // Blocks that reached the threshold
+    int finalized_height;          // Highest of them, -1 if none
+    FinalizedBlock* pending;       // Finalized since the last delivery, oldest first
+    int pending_count;
+    int pending_capacity;
+    pthread_mutex_t delivery_lock; // Keeps deliveries in order, taken without any other lock held
+    void (*on_finalized)(const FinalizedBlock* block); // Listener, set before any node starts, NULL = none
+} ConsensusTracker;
+
+// Event submitted in a batch (see add_blockchain_events)
+typedef struct {
+    int type;                      // Event type (1 = transaction)
+    const char* data;              // Payload, copied when queued
+} EventInput;
+
+// Transaction waiting in the mempool for a miner to pick it up
+typedef struct {
+    Digest hash;                   // Event hash, the deduplication key
+    int type;
+    time_t timestamp;              // Creation time, kept when the event moves into a block
+    char* data;                    // Own copy of the payload, NULL once taken or forgotten
+} PendingEvent;
+
+// Slot of a shard's hash set
+typedef struct {
+    Digest hash;
+    PendingEvent* entry;           // NULL for an empty slot
+} MempoolSlot;
+
+// One shard of the mempool: a FIFO ring of pending events and a hash set over it
+#define MEMPOOL_SHARDS 8           // Independent shards, chosen by event hash
+#define MEMPOOL_SHARD_CAPACITY 128 // Pending events per shard (power of two)
+typedef struct {
+    PendingEvent ring[MEMPOOL_SHARD_CAPACITY];
+    unsigned head;                 // Next event to hand out
+    unsigned tail;                 // Next free slot, tail - head <= MEMPOOL_SHARD_CAPACITY
+    MempoolSlot set[MEMPOOL_SHARD_CAPACITY * 2]; // Pending hashes (open addressing, linear probing)
+    pthread_mutex_t lock;
+} MempoolShard;
+
+// Mempool - transactions submitted to a chain, not yet in a block (see MEMPOOL)
+typedef struct {
+    MempoolShard shards[MEMPOOL_SHARDS];
+    atomic_int pending;            // Events waiting over all shards
+    atomic_uint next_shard;        // Where the next batch starts, so no shard starves
+    atomic_ullong duplicates;      // Submissions refused because the event was already pending
+    atomic_ullong rejected;        // Submissions refused because the shard was full
+} Mempool;
+
+#define ORPHAN_LIMIT 32            // Blocks kept per chain while waiting for their parent
+
+// Snapshot of a chain tip, read without taking the chain lock
+typedef struct {
+    int height;                    // Height of the tip block, -1 for an empty chain
+    Digest hash;                   // Hash of the tip block
+} ChainTip;
+
 // Blockchain 
 typedef struct {
-    Block* genesis;                // First block in the chain ("genesis" block)
     Block* last_block;             // Most recent confirmed block
+    _Atomic(Block*) tip;           // last_block, published for lock-free readers (see CHAIN TIP)
     int block_count;               // Total number of blocks in the chain
     Block* current_mining_block;   // Block currently being assembled (not yet confirmed)
-    pthread_mutex_t lock;          // Lock for thread-safe operations
+    BlockIndex index;              // Blocks of the main chain by hash
+    Block** by_height;             // by_height[h] is the block at height h, the chain holds a reference on each
+    BlockIndex side;               // Blocks of side branches, off the main chain (see BLOCK TREE), referenced too
+    Block* orphans[ORPHAN_LIMIT];  // Blocks whose parent we don't have yet, referenced, oldest first
+    int orphan_count;
+    unsigned long long reorgs;     // Times the tip moved to a side branch
+    int deepest_reorg;             // Most main chain blocks a reorg replaced
+    int height_capacity;           // Allocated size of by_height
+    pthread_rwlock_t lock;         // Readers share the chain, appending or replacing blocks takes it exclusively
+    Mempool mempool;               // Transactions waiting for a block, has its own locks
+    BlockPool pool;                // Spare working blocks, has its own lock
+    struct Node* owner;            // Node whose thread works on this chain, NULL if none
+    int consensus_id;              // Node id the chain is counted as in the consensus tracker, -1 if not counted
+    int checkpoint_height;         // Blocks up to this height passed verify_chain_incremental, -1 = none
+    unsigned rewrites;             // Bumped whenever blocks are truncated or replaced (not appended)
+    struct BlockLog* log;          // On-disk copy of the chain, NULL if not persistent (see BLOCK LOG)
+    atomic_int log_dirty_from;     // Lowest height truncated or replaced since the last chain_persist
 } Blockchain;
 
-// Node 
+// Slot of a node inbox, sequence tells producers and the consumer whose turn it is
+typedef struct {
+    atomic_size_t sequence;
+    Block* block;                  // Retained block handed to the node
+    uint64_t queued;               // monotonic_ns when it was pushed, for the delivery timer
+} InboxSlot;
+
+// Node inbox - bounded lock-free queue, any thread pushes, only the node's thread pops (see NODE INBOX)
+#define INBOX_CAPACITY 64          // Slots per inbox (power of two)
+#define INBOX_BATCH 16             // Blocks applied per chain lock when draining
 typedef struct {
-    int id;                        // Unique identifier for this node
+    InboxSlot slots[INBOX_CAPACITY];
+    atomic_size_t head;            // Next slot to fill, shared by producers
+    size_t tail;                   // Next slot to drain, owned by the node's thread
+    atomic_ullong delivered;       // Blocks queued for this node
+    atomic_ullong dropped;         // Blocks refused because the inbox was full
+    unsigned long long dropped_seen; // Drops already recovered with a resync
+} Inbox;
+
+// Reasons to wake a node's thread, or-ed together in Node.events
+#define NODE_EVENT_BLOCK       0x1 // A block is waiting in the inbox
+#define NODE_EVENT_TRANSACTION 0x2 // A transaction was added to the node's chain
+#define NODE_EVENT_TIP         0x4 // The chain tip moved under the node (resync)
+#define NODE_EVENT_STOP        0x8 // Shutdown requested or node stopped
+
+// Node 
+typedef struct Node {
+    int id;                        // Unique identifier for this node, its index in nodes[]
     Blockchain* chain;             // This node's copy of the blockchain
     bool is_mining;                // Whether this node is actively mining
     bool is_malicious;             // Whether this node attempts to tamper with data
-    bool is_active;                // Whether this node is currently online
+    atomic_bool is_active;         // Whether this node is currently online, read by other threads without a lock
+    int active_slot;               // Position in active_nodes[], -1 while offline
     pthread_t thread;              // Thread handling this node's operations
+    Inbox inbox;                   // Blocks broadcast by other nodes, waiting to be applied
+    atomic_uint events;            // NODE_EVENT_* bits not handled yet
+    atomic_bool waiting;           // The node's thread is (about to be) asleep on wakeup
+    pthread_mutex_t wait_lock;     // Only used to sleep, notifiers don't take it unless the node waits
+    pthread_cond_t wakeup;
+    atomic_bool mining_cancel;     // Set when the tip moves under the block being mined
+    atomic_ullong cancelled_jobs;  // Mining jobs stopped early because a competing block arrived
+    atomic_ullong cancelled_hashes; // Hashes spent on those jobs before they stopped
+    atomic_ullong stale_blocks;    // Blocks mined to the end and then discarded (tip had moved)
 } Node;
 
+// Chain parameters - set once at startup from the command line, before any chain exists
+// Every node of a network must use the same values, they decide which blocks are valid
+typedef struct {
+    int max_events;                // Maximum events per block
+    uint64_t difficulty;           // Expected hashes per block at genesis, retargets never go below it
+    uint32_t initial_bits;         // Compact target of difficulty, filled in by chain_params_apply
+    double consensus_threshold;    // Share of active nodes that must hold a block for consensus
+    int target_block_ms;           // Wanted time between blocks, 0 keeps the difficulty fixed
+    int retarget_interval;         // Blocks between two retargets
+} ChainParams;
+
+// Mining statistics - filled in by mine_block_with_stats
+typedef struct {
+    unsigned long long hashes;     // Number of nonces tried by all workers
+    double seconds;                // Wall-clock time spent mining
+    double hash_rate;              // Hashes per second
+} MiningStats;
+
+// Nonce search job shared by all workers mining the same block
+typedef struct {
+    HashState midstate;            // Hash state after the fixed header prefix, shared read-only
+    Digest target;                 // The hash must not exceed this (from the block's bits)
+    int stride;                    // Number of workers, each worker tries every stride-th nonce
+    atomic_bool found;             // Set by the first worker that finds a solution, stops the others
+    atomic_int winning_nonce;      // Nonce found by the winning worker
+    atomic_ullong hashes;          // Total number of nonces tried by all workers
+    atomic_bool* cancel;           // Set by someone else when the work became stale, may be NULL
+    int running;                   // Helpers still working on the job, guarded by mining_pool.lock
+} MiningJob;
+
+// One worker of a mining job: the mining thread itself, or a helper of the mining pool
+typedef struct {
+    MiningJob* job;                // Job handed to a helper, NULL while it is idle
+    int first_nonce;               // Worker w starts at nonce w
+    pthread_t thread;
+    pthread_cond_t wake;           // Signaled when a helper is handed a job or the pool stops
+} MiningWorker;
+
+// Helper threads shared by every mining job of the process, started on first use
+// Helpers are created once and handed jobs, a mining job only pays for a wakeup
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;           // A helper finished its share of a job
+    MiningWorker** helpers;        // Each helper is allocated on its own, they never move
+    int count;
+    int capacity;
+    bool stopping;                 // Set by mining_pool_stop
+} MiningPool;
+
+// Counters every thread keeps for itself (see METRICS)
+typedef enum {
+    COUNTER_HASHES,                // Proof of Work hashes tried
+    COUNTER_BLOCKS_MINED,          // Mined blocks that made it onto the miner's chain
+    COUNTER_STALE_BLOCKS,          // Mined blocks discarded because the tip moved meanwhile
+    COUNTER_CANCELLED_JOBS,        // Mining jobs cut short by a new tip
+    COUNTER_CLONE_BYTES,           // Bytes copied by block clones (events and Merkle state)
+    COUNTER_BLOCKS_APPLIED,        // Blocks taken from an inbox and applied
+    COUNTER_CHAIN_LOCKS,           // chain->lock acquisitions
+    COUNTER_NODES_LOCKS,           // nodes_lock acquisitions
+    COUNTER_COUNT
+} MetricCounter;
+
+// Durations every thread keeps for itself as histograms
+typedef enum {
+    TIMER_MINING,                  // One mining job, start to result
+    TIMER_DELIVERY,                // Block queued in an inbox until the receiving node applied it
+    TIMER_CHAIN_LOCK_WAIT,         // Waiting for a contended chain->lock
+    TIMER_NODES_LOCK_WAIT,         // Waiting for a contended nodes_lock
+    TIMER_SYNC,                    // One synchronization with the chain with the most work
+    TIMER_COUNT
+} MetricTimer;
+
+// Power of two histogram of nanoseconds, bucket b holds durations below 2^b
+#define HISTOGRAM_BUCKETS 64
+typedef struct {
+    _Atomic uint64_t buckets[HISTOGRAM_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;          // Total nanoseconds
+    _Atomic uint64_t max;
+} Histogram;
+
+// A span of time on one thread, for the trace file
+typedef struct {
+    const char* name;              // String literal
+    uint64_t start;                // Monotonic nanoseconds
+    uint64_t duration;
+    int64_t value;                 // Something about the span (height, hashes...), -1 if nothing
+} TraceEvent;
+
+#define TRACE_RING_EVENTS 4096     // Trace events a thread buffers until the reporter writes them (power of two)
+
+// Metrics of one thread: only that thread writes them, with plain relaxed stores,
+// and the reporter sums them up with relaxed loads, so recording never waits
+typedef struct ThreadMetrics {
+    struct ThreadMetrics* next;    // Every thread that recorded something, newest first
+    int id;                        // Registration order, the trace's thread id
+    char name[24];                 // Set by metrics_name_thread, guarded by metrics.lock
+    bool named;                    // Name written to the trace file
+    _Atomic uint64_t counters[COUNTER_COUNT];
+    Histogram timers[TIMER_COUNT];
+    TraceEvent* trace;             // Ring of TRACE_RING_EVENTS, NULL when not tracing
+    atomic_size_t trace_head;      // Next event to record, advanced by the thread
+    atomic_size_t trace_tail;      // Next event to write out, advanced by the reporter
+    _Atomic uint64_t trace_dropped; // Events lost because the ring was full
+} ThreadMetrics;
+
+// Process-wide metrics state (see METRICS)
+typedef struct {
+    pthread_mutex_t lock;          // Thread list, trace file and reporter wakeup
+    pthread_cond_t wakeup;         // Wakes the reporter to stop
+    ThreadMetrics* threads;        // Every registered thread, never freed before metrics_free
+    int thread_count;
+    int interval;                  // Seconds between periodic snapshots, 0 = only at exit
+    const char* trace_path;        // Chrome trace event file (--trace), NULL = no tracing
+    FILE* trace_file;
+    unsigned long long trace_written; // Events written to the trace file
+    uint64_t started;              // Monotonic nanoseconds at metrics_start
+    pthread_t reporter;
+    bool reporter_running;
+    bool stopping;
+    uint64_t last_time;            // Previous periodic snapshot, for rates
+    uint64_t last_hashes;
+} Metrics;
+
+// Sum of the metrics of every thread at one moment (see metrics_collect)
+typedef struct {
+    uint64_t counters[COUNTER_COUNT];
+    uint64_t buckets[TIMER_COUNT][HISTOGRAM_BUCKETS];
+    uint64_t count[TIMER_COUNT];
+    uint64_t sum[TIMER_COUNT];
+    uint64_t max[TIMER_COUNT];
+    uint64_t trace_dropped;
+    int threads;
+} MetricsSnapshot;
+
+// Result of verify_chain / verify_chain_incremental
+typedef struct {
+    int from_height;               // First height checked
+    int blocks;                    // Number of blocks checked
+    int events;                    // Number of events rehashed
+    int first_invalid;             // Lowest invalid height, -1 if every block checked is valid
+    double seconds;                // Wall-clock time of the verification
+} ChainVerification;
+
+// Growable byte buffer, used to encode messages and to queue socket input and output
+typedef struct {
+    uint8_t* bytes;
+    size_t length;                 // Bytes in use
+    size_t capacity;               // Bytes allocated
+} ByteBuffer;
+
+// On-disk copy of a chain: an append-only block file and a height index (see BLOCK LOG)
+#define BLOCK_LOG_ENTRY_SIZE 48    // offset (8) | length (4) | height (4) | hash (32)
+typedef struct BlockLog {
+    int data_fd;                   // <prefix>.blocks, records are only ever appended
+    int index_fd;                  // <prefix>.index, entry h describes the block at height h
+    uint64_t data_size;            // Bytes in the block file
+    int count;                     // Entries in the index
+    ByteBuffer scratch;            // Encoding buffer reused by every write
+    pthread_mutex_t lock;          // One writer at a time, taken before the chain lock
+} BlockLog;
+
+// Cursor over a received message, reads past the end set failed instead of overrunning
+typedef struct {
+    const uint8_t* position;
+    size_t left;                   // Bytes not read yet
+    bool failed;
+} WireReader;
+
+// Encoded block read in place (see block_view_open), nothing is copied or allocated
+// The header fields are decoded, the events are walked with block_view_next_event
+typedef struct {
+    int index;
+    int64_t timestamp;
+    const uint8_t* previous_hash;  // DIGEST_SIZE bytes inside the encoding
+    const uint8_t* merkle_root;    // DIGEST_SIZE bytes inside the encoding
+    uint32_t bits;
+    uint32_t nonce;
+    uint32_t event_count;
+    uint32_t events_read;          // Events returned by block_view_next_event so far
+    WireReader events;             // Cursor over the encoded events
+    size_t encoded_size;           // Bytes of the whole block encoding
+} BlockView;
+
+// One event of a BlockView, data points into the encoding and is not NUL terminated
+typedef struct {
+    int type;
+    int64_t timestamp;
+    const char* data;
+    uint32_t data_length;
+} EventView;
+
+// Message types of the wire protocol (see WIRE FORMAT)
+#define MSG_HELLO      1           // Sent by both sides on connect: protocol, node id, height, genesis
+#define MSG_BLOCK      2           // A newly mined block
+#define MSG_EVENT      3           // A transaction to queue in the mempool
+#define MSG_GET_BLOCKS 4           // Locator of our chain, asks for the blocks after the last shared one
+#define MSG_CHAIN      5           // Blocks answering MSG_GET_BLOCKS, in height order
+
+#define WIRE_VERSION 0x42430003u   // Protocol magic and version, checked in MSG_HELLO
+#define BLOCK_FORMAT_VERSION 2     // First byte of every encoded block (wire and block log)
+#define WIRE_MAX_FRAME (16u << 20) // Largest message accepted from a peer
+#define WIRE_MAX_BLOCK (WIRE_MAX_FRAME - 64) // Largest block encoding, every block fits a frame on its own
+#define MAX_EVENT_DATA (WIRE_MAX_BLOCK - 256) // Largest event payload, it always fits an empty block
+#define PEER_OUTPUT_LIMIT (64u << 20) // A peer with more unsent output is too slow and gets disconnected
+#define CHAIN_BATCH_BLOCKS 256     // Blocks per MSG_CHAIN, the requester asks again for the rest
+#define LOCATOR_MAX 64             // Hashes in a MSG_GET_BLOCKS locator
+#define SEEN_BLOCKS 256            // Recently relayed block hashes, so a block crosses every link once
+#define RECONNECT_INTERVAL_MS 1000 // Retry delay for configured peers that are not connected
+#define SYNC_RETRY_MS 5000         // A MSG_GET_BLOCKS unanswered for this long may be sent again
+
+// Connection to a node in another process (see NETWORK PEERS)
+typedef struct Peer {
+    int fd;
+    int id;                        // Remote node id from its MSG_HELLO, -1 before
+    int seed;                      // Index of the --peer address it was dialed from, -1 if accepted
+    char address[64];              // host:port, for logs
+    bool connecting;               // Non-blocking connect still in progress
+    bool ready;                    // MSG_HELLO received
+    atomic_bool failed;            // Socket error seen by a sender, closed by the transport thread
+    ByteBuffer input;              // Received bytes not forming a full message yet (transport thread only)
+    ByteBuffer output;             // Queued bytes not accepted by the socket yet
+    size_t output_sent;            // Bytes of output already written
+    bool want_write;               // EPOLLOUT is armed for the socket
+    pthread_mutex_t lock;          // Protects output, output_sent and want_write
+    long long sync_requested_ms;   // When our unanswered MSG_GET_BLOCKS went out, 0 if none (transport thread only)
+} Peer;
+
+// Network transport - one epoll loop thread per process (see NETWORK TRANSPORT)
+typedef struct {
+    atomic_bool running;
+    Node* node;                    // Local node blocks and transactions are delivered to
+    int epoll_fd;
+    int listen_fd;                 // -1 without --listen
+    int wake_fd;                   // eventfd, wakes the loop to stop or to close failed peers
+    pthread_t thread;
+    Peer** peers;                  // Open connections
+    int peer_count;
+    int peer_capacity;
+    pthread_mutex_t peers_lock;    // Protects the peers array, taken before any Peer.lock
+    char** seeds;                  // Addresses given with --peer, redialed while not connected
+    int seed_count;
+    bool* seed_connected;
+    Digest seen[SEEN_BLOCKS];      // Ring of recently relayed blocks (transport thread only)
+    int seen_next;
+    atomic_ullong messages_in;
+    atomic_ullong messages_out;
+    atomic_ullong bytes_in;
+    atomic_ullong bytes_out;
+} Transport;
+
 /* 
  * GLOBAL VARIABLES 
  */
 
-Node nodes[MAX_NODES];             // Array of all nodes in the network
-int node_count = 0;                // Current number of active nodes
-pthread_mutex_t nodes_lock = PTHREAD_MUTEX_INITIALIZER; // Lock for thread-safe node operations
-bool shutdown_requested = false;   // Flag to signal system shutdown
+Node** nodes = NULL;               // Every node ever created, by id (nodes never move when the registry grows)
+int node_count = 0;                // Number of nodes created
+int node_capacity = 0;             // Allocated size of nodes[] and active_nodes[]
+Node** active_nodes = NULL;        // Dense list of online nodes, in no particular order
+int active_count = 0;              // Number of online nodes
+pthread_rwlock_t nodes_lock = PTHREAD_RWLOCK_INITIALIZER; // Node registry: read to walk nodes[] or active_nodes[], write to add or toggle a node
+pthread_mutex_t node_create_lock = PTHREAD_MUTEX_INITIALIZER; // One create_blockchain_node at a time, taken before nodes_lock
+// Lock order: nodes_lock, then at most one chain->lock at a time, then the block store or consensus lock
+BlockStore block_store = { .lock = PTHREAD_MUTEX_INITIALIZER }; // Confirmed blocks shared by all nodes
+ConsensusTracker consensus = { .lock = PTHREAD_MUTEX_INITIALIZER, .delivery_lock = PTHREAD_MUTEX_INITIALIZER,
+                               .finalized_height = -1 }; // Holders of every block
+atomic_bool shutdown_requested = false;  // Flag to signal system shutdown, polled by every thread
+int mining_threads = 0;            // Worker threads per mining job (0 = one per online core)
+MiningPool mining_pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER }; // Mining helpers
+ChainParams chain_params = {       // Runtime chain parameters, chain_params_apply must run before use
+    .max_events = DEFAULT_MAX_EVENTS,
+    .difficulty = DEFAULT_DIFFICULTY,
+    .consensus_threshold = DEFAULT_CONSENSUS_THRESHOLD,
+    .target_block_ms = 0,
+    .retarget_interval = DEFAULT_RETARGET_INTERVAL,
+};
+bool simulation_mode = false;      // Throttle mining and allow random early exits (demo only)
+time_t genesis_timestamp = 0;      // Fixed genesis time so separate processes share a genesis block, 0 = creation time
+volatile sig_atomic_t stop_signal = 0; // Set by SIGINT/SIGTERM in network mode
+const char* data_dir = NULL;       // Where chains are kept on disk (--data-dir), NULL = memory only
+bool data_resume = false;          // Load chains found in data_dir at creation (network mode) instead of starting over
+Transport transport = { .listen_fd = -1, .wake_fd = -1, .epoll_fd = -1,
+                        .peers_lock = PTHREAD_MUTEX_INITIALIZER }; // Links to nodes in other processes
+Metrics metrics = { .lock = PTHREAD_MUTEX_INITIALIZER, .wakeup = PTHREAD_COND_INITIALIZER }; // Counters and timers of every thread
+bool log_blocks = true;            // Print a line per mined block and sync (--quiet turns it off, metrics still count)
 
 /*
- * HASHING FUNCTIONS
- * Core cryptographic operations for data integrity
+ * METRICS
+ * Counters and duration histograms kept per thread. The hot paths record them
+ * with a relaxed store to memory no other thread writes: no lock, no shared
+ * cache line, no printf. Waits on chain->lock and nodes_lock are only timed
+ * when the lock is contended. A reporter thread adds every thread's metrics up
+ * for periodic snapshots (--metrics S), and with --trace FILE it writes the
+ * spans threads buffered in their rings as Chrome trace events (chrome://tracing
+ * or Perfetto read the file).
  */
 
-// Simple hash function just to simulate my tp, hash function library didn't work for me 
-void hash_data(const char* input, char* output) {
-    unsigned long hash = 5381;
-    while (*input) hash = ((hash << 5) + hash) + *input++;
-    sprintf(output, "%016lx", hash);
+#define TRACE_FLUSH_MS 100  // How often the reporter writes buffered trace events
+
+static const char* const timer_names[TIMER_COUNT] = {
+    "mining job", "block delivery", "chain lock wait", "nodes lock wait", "sync",
+};
+
+static __thread ThreadMetrics* local_metrics;  // The calling thread's metrics, registered on first use
+
+// Nanoseconds on the monotonic clock
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// The calling thread's metrics, NULL if memory allocation failed
+static ThreadMetrics* metrics_local(void) {
+    ThreadMetrics* local = local_metrics;
+    if (local) return local;
+    local = calloc(1, sizeof(ThreadMetrics));
+    if (!local) return NULL;
     
-    // Fill with zeros to reach HASH_SIZE
-    int len = strlen(output);
-    memset(output + len, '0', HASH_SIZE - len);
-    output[HASH_SIZE] = '\0';
+    pthread_mutex_lock(&metrics.lock);
+    if (metrics.trace_file) local->trace = malloc(TRACE_RING_EVENTS * sizeof(TraceEvent));
+    local->id = metrics.thread_count++;
+    snprintf(local->name, sizeof(local->name), "thread %d", local->id);
+    local->next = metrics.threads;
+    metrics.threads = local;
+    pthread_mutex_unlock(&metrics.lock);
+    
+    local_metrics = local;
+    return local;
 }
 
-/*
- * EVENT OPERATIONS
- * Functions for handling individual transactions
- */
+// Name the calling thread in the trace file
+void metrics_name_thread(const char* name) {
+    ThreadMetrics* local = metrics_local();
+    if (!local) return;
+    pthread_mutex_lock(&metrics.lock);
+    snprintf(local->name, sizeof(local->name), "%s", name);
+    local->named = false;
+    pthread_mutex_unlock(&metrics.lock);
+}
 
-// Generate a unique hash for an event based on its contents
-void hash_event(Event* event) {
-    // Combine all event data to create a unique hash
-    char buffer[512];
-    sprintf(buffer, "%d%s%s", event->type, event->data, event->timestamp);
-    hash_data(buffer, event->hash);
+// Only the owning thread writes a metric, so load and store is enough (no locked add)
+static inline void metric_bump(_Atomic uint64_t* metric, uint64_t amount) {
+    atomic_store_explicit(metric, atomic_load_explicit(metric, memory_order_relaxed) + amount,
+                          memory_order_relaxed);
 }
 
-/*
- * MERKLE TREE OPERATIONS
- * Functions for creating and managing the Merkle tree data structure
- */
+// Add to one of the calling thread's counters
+void metrics_count(MetricCounter counter, uint64_t amount) {
+    ThreadMetrics* local = metrics_local();
+    if (local) metric_bump(&local->counters[counter], amount);
+}
 
-// Create a new node in the Merkle tree
-MerkleNode* create_merkle_node(const char* hash) {
-    MerkleNode* node = malloc(sizeof(MerkleNode));
-    strcpy(node->hash, hash);
-    node->left = node->right = NULL;
-    return node;
+// Record the time between two monotonic_ns readings in one of the calling thread's timers
+void metrics_time(MetricTimer timer, uint64_t start, uint64_t end) {
+    ThreadMetrics* local = metrics_local();
+    if (!local) return;
+    uint64_t duration = end > start ? end - start : 0;
+    int bucket = duration ? 64 - __builtin_clzll(duration) : 0;  // Smallest b with duration < 2^b
+    if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+    
+    Histogram* histogram = &local->timers[timer];
+    metric_bump(&histogram->buckets[bucket], 1);
+    metric_bump(&histogram->count, 1);
+    metric_bump(&histogram->sum, duration);
+    if (duration > atomic_load_explicit(&histogram->max, memory_order_relaxed)) {
+        atomic_store_explicit(&histogram->max, duration, memory_order_relaxed);
+    }
 }
 
-// Free the memory used by a Merkle tree
-void free_tree(MerkleNode* root) {
-    if (!root) return;
-    free_tree(root->left);
-    free_tree(root->right);
-    free(root);
-}
-
-// Recursively build a Merkle tree from an array of hashes
-MerkleNode* build_tree(char** hashes, int start, int end) {
-    // Base cases: empty range or single hash
-    if (start > end) return NULL;
-    if (start == end) return create_merkle_node(hashes[start]);
-    
-    // Divide and conquer: build left and right subtrees
-    int mid = (start + end) / 2;
-    MerkleNode* left = build_tree(hashes, start, mid);
-    MerkleNode* right = build_tree(hashes, mid + 1, end);
-    
-    // For odd number of nodes, duplicate the last one
-    // This ensures every parent has exactly two children
-    if (!right) right = create_merkle_node(left->hash);
-    
-    // Create parent node with combined hash of children
-    MerkleNode* parent = create_merkle_node("");
-    char combined[HASH_SIZE*2 + 1];
-    sprintf(combined, "%s%s", left->hash, right->hash);
-    hash_data(combined, parent->hash);
-    
-    parent->left = left;
-    parent->right = right;
-    return parent;
-}
-
-// Calculate the Merkle root hash for a block's events
-void calculate_merkle_root(Block* block) {
-    if (block->event_count == 0) {
-        // Empty block gets all zeros for its Merkle root
-        memset(block->merkle_root, '0', HASH_SIZE);
-        block->merkle_root[HASH_SIZE] = '\0';
+// Buffer a span for the trace file, name must be a string literal
+// Does nothing when not tracing, and the span is lost if the reporter fell behind
+void trace_span(const char* name, uint64_t start, uint64_t end, int64_t value) {
+    ThreadMetrics* local = metrics_local();
+    if (!local || !local->trace) return;
+    size_t head = atomic_load_explicit(&local->trace_head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&local->trace_tail, memory_order_acquire) >= TRACE_RING_EVENTS) {
+        metric_bump(&local->trace_dropped, 1);
         return;
     }
+    local->trace[head & (TRACE_RING_EVENTS - 1)] = (TraceEvent){ name, start, end > start ? end - start : 0, value };
+    atomic_store_explicit(&local->trace_head, head + 1, memory_order_release);
+}
+
+// Record a span that started at start and ends now, in a timer and the trace
+void metrics_span(MetricTimer timer, const char* name, uint64_t start, int64_t value) {
+    uint64_t end = monotonic_ns();
+    metrics_time(timer, start, end);
+    trace_span(name, start, end, value);
+}
+
+// Take a registry or chain lock: a lock nobody holds costs a trylock and a counter,
+// only a thread that has to wait reads the clock
+static void rwlock_metered(pthread_rwlock_t* lock, bool write, MetricCounter counter,
+                           MetricTimer timer, const char* name) {
+    metrics_count(counter, 1);
+    if ((write ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock)) == 0) return;
+    uint64_t start = monotonic_ns();
+    if (write) {
+        pthread_rwlock_wrlock(lock);
+    } else {
+        pthread_rwlock_rdlock(lock);
+    }
+    metrics_span(timer, name, start, -1);
+}
+
+void chain_read_lock(Blockchain* chain) {
+    rwlock_metered(&chain->lock, false, COUNTER_CHAIN_LOCKS, TIMER_CHAIN_LOCK_WAIT, "chain lock wait");
+}
+
+void chain_write_lock(Blockchain* chain) {
+    rwlock_metered(&chain->lock, true, COUNTER_CHAIN_LOCKS, TIMER_CHAIN_LOCK_WAIT, "chain lock wait");
+}
+
+void nodes_read_lock(void) {
+    rwlock_metered(&nodes_lock, false, COUNTER_NODES_LOCKS, TIMER_NODES_LOCK_WAIT, "nodes lock wait");
+}
+
+void nodes_write_lock(void) {
+    rwlock_metered(&nodes_lock, true, COUNTER_NODES_LOCKS, TIMER_NODES_LOCK_WAIT, "nodes lock wait");
+}
+
+// Add up the metrics of every thread, threads keep recording meanwhile
+void metrics_collect(MetricsSnapshot* snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    pthread_mutex_lock(&metrics.lock);
+    for (ThreadMetrics* thread = metrics.threads; thread; thread = thread->next) {
+        snapshot->threads++;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            snapshot->counters[c] += atomic_load_explicit(&thread->counters[c], memory_order_relaxed);
+        }
+        for (int t = 0; t < TIMER_COUNT; t++) {
+            Histogram* histogram = &thread->timers[t];
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                snapshot->buckets[t][b] += atomic_load_explicit(&histogram->buckets[b], memory_order_relaxed);
+            }
+            snapshot->count[t] += atomic_load_explicit(&histogram->count, memory_order_relaxed);
+            snapshot->sum[t] += atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+            uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            if (max > snapshot->max[t]) snapshot->max[t] = max;
+        }
+        snapshot->trace_dropped += atomic_load_explicit(&thread->trace_dropped, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&metrics.lock);
+}
+
+// Upper bound of the q quantile of a timer (the end of its bucket, at most the max), in nanoseconds
+static uint64_t snapshot_quantile(const MetricsSnapshot* snapshot, int timer, double q) {
+    uint64_t count = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) count += snapshot->buckets[timer][b];
+    uint64_t rank = (uint64_t)(q * count);
+    uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += snapshot->buckets[timer][b];
+        if (seen > rank) return (1ull << b) < snapshot->max[timer] ? 1ull << b : snapshot->max[timer];
+    }
+    return snapshot->max[timer];
+}
+
+// Duration for display
+static void format_ns(uint64_t ns, char* text, size_t size) {
+    if (ns < 1000) {
+        snprintf(text, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(text, size, "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(text, size, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(text, size, "%.2fs", ns / 1e9);
+    }
+}
+
+// Print the metrics of every thread added up, with the hash rate since the last call
+void metrics_print(const char* title) {
+    MetricsSnapshot snapshot;
+    metrics_collect(&snapshot);
+    uint64_t now = monotonic_ns();
+    uint64_t hashes = snapshot.counters[COUNTER_HASHES];
+    double elapsed = (now - metrics.started) / 1e9;
+    double recent = (now - metrics.last_time) / 1e9;
     
-    // Collect all event hashes
-    char** hashes = malloc(block->event_count * sizeof(char*));
-    for (int i = 0; i < block->event_count; i++) {
-        hashes[i] = block->events[i].hash;
+    printf("=== METRICS (%s): %.1f s, %d threads ===\n", title, elapsed, snapshot.threads);
+    printf("Mining: %llu blocks, %llu stale, %llu jobs cancelled, %llu hashes (%.0f H/s, %.0f H/s lately)\n",
+           (unsigned long long)snapshot.counters[COUNTER_BLOCKS_MINED],
+           (unsigned long long)snapshot.counters[COUNTER_STALE_BLOCKS],
+           (unsigned long long)snapshot.counters[COUNTER_CANCELLED_JOBS],
+           (unsigned long long)hashes, elapsed > 0 ? hashes / elapsed : 0,
+           recent > 0 ? (hashes - metrics.last_hashes) / recent : 0);
+    printf("Blocks applied from inboxes: %llu, bytes cloned: %llu, lock acquisitions: %llu chain, %llu nodes\n",
+           (unsigned long long)snapshot.counters[COUNTER_BLOCKS_APPLIED],
+           (unsigned long long)snapshot.counters[COUNTER_CLONE_BYTES],
+           (unsigned long long)snapshot.counters[COUNTER_CHAIN_LOCKS],
+           (unsigned long long)snapshot.counters[COUNTER_NODES_LOCKS]);
+    for (int t = 0; t < TIMER_COUNT; t++) {
+        if (snapshot.count[t] == 0) continue;
+        char average[16], median[16], p99[16], max[16];
+        format_ns(snapshot.sum[t] / snapshot.count[t], average, sizeof(average));
+        format_ns(snapshot_quantile(&snapshot, t, 0.5), median, sizeof(median));
+        format_ns(snapshot_quantile(&snapshot, t, 0.99), p99, sizeof(p99));
+        format_ns(snapshot.max[t], max, sizeof(max));
+        printf("  %-16s n=%-8llu avg %-8s p50 <= %-8s p99 <= %-8s max %s\n", timer_names[t],
+               (unsigned long long)snapshot.count[t], average, median, p99, max);
+    }
+    if (snapshot.trace_dropped) {
+        printf("  %llu trace events dropped\n", (unsigned long long)snapshot.trace_dropped);
+    }
+    metrics.last_time = now;
+    metrics.last_hashes = hashes;
+}
+
+// Separator before the next trace event, the caller holds metrics.lock
+static const char* trace_separator(void) {
+    return metrics.trace_written++ ? ",\n" : "";
+}
+
+// Write the spans every thread buffered to the trace file, the caller holds metrics.lock
+static void trace_flush_locked(void) {
+    if (!metrics.trace_file) return;
+    int pid = (int)getpid();
+    for (ThreadMetrics* thread = metrics.threads; thread; thread = thread->next) {
+        if (!thread->trace) continue;
+        if (!thread->named) {
+            fprintf(metrics.trace_file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", trace_separator(), pid, thread->id, thread->name);
+            thread->named = true;
+        }
+        size_t tail = atomic_load_explicit(&thread->trace_tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&thread->trace_head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            const TraceEvent* event = &thread->trace[tail & (TRACE_RING_EVENTS - 1)];
+            fprintf(metrics.trace_file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"value\":%lld}}", trace_separator(),
+                    event->name, pid, thread->id, (double)(int64_t)(event->start - metrics.started) / 1e3,
+                    event->duration / 1e3, (long long)event->value);
+        }
+        atomic_store_explicit(&thread->trace_tail, tail, memory_order_release);
     }
+    fflush(metrics.trace_file);
+}
+
+// Reporter thread: writes trace events every TRACE_FLUSH_MS and prints a snapshot every interval
+static void* metrics_reporter(void* arg) {
+    (void)arg;
+    metrics_name_thread("metrics");
+    uint64_t period = metrics.trace_file ? TRACE_FLUSH_MS * 1000000ull : (uint64_t)metrics.interval * 1000000000ull;
+    uint64_t next_snapshot = metrics.interval ? monotonic_ns() + (uint64_t)metrics.interval * 1000000000ull : UINT64_MAX;
     
-    // Build the Merkle tree and get its root hash
-    MerkleNode* root = build_tree(hashes, 0, block->event_count - 1);
-    strcpy(block->merkle_root, root->hash);
+    pthread_mutex_lock(&metrics.lock);
+    while (!metrics.stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t nanoseconds = (uint64_t)deadline.tv_nsec + period;
+        deadline.tv_sec += nanoseconds / 1000000000ull;
+        deadline.tv_nsec = nanoseconds % 1000000000ull;
+        pthread_cond_timedwait(&metrics.wakeup, &metrics.lock, &deadline);
+        
+        trace_flush_locked();
+        if (!metrics.stopping && monotonic_ns() >= next_snapshot) {
+            pthread_mutex_unlock(&metrics.lock);
+            metrics_print("snapshot");
+            pthread_mutex_lock(&metrics.lock);
+            next_snapshot += (uint64_t)metrics.interval * 1000000000ull;
+        }
+    }
+    pthread_mutex_unlock(&metrics.lock);
+    return NULL;
+}
+
+// Open the trace file and start the reporter if snapshots or tracing were asked for
+// Returns false if the trace file can't be created
+bool metrics_start(void) {
+    metrics.started = metrics.last_time = monotonic_ns();
+    if (metrics.trace_path) {
+        metrics.trace_file = fopen(metrics.trace_path, "w");
+        if (!metrics.trace_file) {
+            fprintf(stderr, "Cannot create %s: %s\n", metrics.trace_path, strerror(errno));
+            return false;
+        }
+        fprintf(metrics.trace_file, "[\n");
+    }
+    metrics_name_thread("main");
+    if (metrics.interval > 0 || metrics.trace_file) {
+        metrics.reporter_running = pthread_create(&metrics.reporter, NULL, metrics_reporter, NULL) == 0;
+    }
+    return true;
+}
+
+// Stop the reporter, print the final snapshot and finish the trace file
+void metrics_stop(void) {
+    if (metrics.reporter_running) {
+        pthread_mutex_lock(&metrics.lock);
+        metrics.stopping = true;
+        pthread_cond_signal(&metrics.wakeup);
+        pthread_mutex_unlock(&metrics.lock);
+        pthread_join(metrics.reporter, NULL);
+        metrics.reporter_running = false;
+    }
+    metrics_print("at exit");
     
-    // Clean up
-    free_tree(root);
-    free(hashes);
+    pthread_mutex_lock(&metrics.lock);
+    trace_flush_locked();
+    if (metrics.trace_file) {
+        fprintf(metrics.trace_file, "\n]\n");
+        fclose(metrics.trace_file);
+        metrics.trace_file = NULL;
+        printf("Trace: %llu events written to %s\n", metrics.trace_written, metrics.trace_path);
+    }
+    pthread_mutex_unlock(&metrics.lock);
+}
+
+// Free the metrics of every thread, once no other thread is left to record
+void metrics_free(void) {
+    pthread_mutex_lock(&metrics.lock);
+    while (metrics.threads) {
+        ThreadMetrics* next = metrics.threads->next;
+        free(metrics.threads->trace);
+        free(metrics.threads);
+        metrics.threads = next;
+    }
+    metrics.thread_count = 0;
+    pthread_mutex_unlock(&metrics.lock);
+    local_metrics = NULL;
 }
 
 /*
- * BLOCK OPERATIONS
- * Functions for creating and managing blocks
+ * HASHING FUNCTIONS
+ * Core cryptographic operations for data integrity
  */
 
-// Generate a unique hash for a block based on its contents
-void hash_block(Block* block) {
-    char buffer[1024];
-    sprintf(buffer, "%d%ld%s%s%d", 
-            block->index, block->timestamp, 
-            block->previous_hash, block->merkle_root, block->nonce);
-    hash_data(buffer, block->hash);
+// SHA-256, written out here because the hash function library didn't work for me
+// It is split in init/update/final so a caller can hash a common prefix once,
+// keep the state, and only feed the bytes that change (see hash_block_prefix)
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Hash value before any input
+static const uint32_t sha256_initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Process one 64-byte block of input
+static void sha256_compress(uint32_t state[8], const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i*4] << 24) | ((uint32_t)block[i*4+1] << 16) |
+               ((uint32_t)block[i*4+2] << 8) | (uint32_t)block[i*4+3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+                      ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
 }
 
-// Create a new empty block with the given index and previous hash
-Block* create_block(int index, const char* prev_hash) {
-    Block* block = malloc(sizeof(Block));
+// Start a new hash computation
+void hash_init(HashState* state) {
+    memcpy(state->h, sha256_initial, sizeof(sha256_initial));
+    state->buffered = 0;
+    state->length = 0;
+}
+
+// Mix len bytes into the hash state
+void hash_update(HashState* state, const void* data, size_t len) {
+    const uint8_t* bytes = data;
+    state->length += len;
     
-    block->index = index;
-    block->timestamp = time(NULL);  // Current time
-    strcpy(block->previous_hash, prev_hash);
+    // Top up a partially filled block first
+    if (state->buffered) {
+        size_t take = 64 - state->buffered;
+        if (take > len) take = len;
+        memcpy(state->buffer + state->buffered, bytes, take);
+        state->buffered += take;
+        bytes += take;
+        len -= take;
+        if (state->buffered < 64) return;
+        sha256_compress(state->h, state->buffer);
+        state->buffered = 0;
+    }
     
-    // Initialize events array with initial capacity
-    block->event_capacity = 10;  // Start with space for 10 events
-    block->events = malloc(block->event_capacity * sizeof(Event));
-    block->event_count = 0;
-    block->nonce = 0;  // Will be determined during mining
-    block->next = NULL;
+    // Whole blocks go straight from the input
+    while (len >= 64) {
+        sha256_compress(state->h, bytes);
+        bytes += 64;
+        len -= 64;
+    }
     
-    return block;
+    memcpy(state->buffer, bytes, len);
+    state->buffered = len;
 }
 
-// Create a deep copy of a block - for nodes 
-Block* clone_block(Block* source) {
-    Block* block = malloc(sizeof(Block));
-    
-    // Copy all basic properties
-    block->index = source->index;
-    block->timestamp = source->timestamp;
-    strcpy(block->previous_hash, source->previous_hash);
-    strcpy(block->merkle_root, source->merkle_root);
-    strcpy(block->hash, source->hash);
-    block->nonce = source->nonce;
-    block->next = NULL;  // we don't copy next pointer 
-    //cus cloned blocks are meant to be temporary working copies, not full chain replicas
+// Apply the padding and write the final digest
+void hash_final(const HashState* state, Digest* output) {
+    uint32_t h[8];
+    uint8_t block[64];
+    memcpy(h, state->h, sizeof(h));
+    memcpy(block, state->buffer, state->buffered);
     
-    // Clone events array
-    block->event_capacity = source->event_capacity;
-    block->event_count = source->event_count;
-    block->events = malloc(block->event_capacity * sizeof(Event));
-    memcpy(block->events, source->events, source->event_count * sizeof(Event));
+    // Padding: a single 1 bit, zeros, then the message length in bits
+    size_t used = state->buffered;
+    block[used++] = 0x80;
+    if (used > 56) {
+        memset(block + used, 0, 64 - used);
+        sha256_compress(h, block);
+        used = 0;
+    }
+    memset(block + used, 0, 56 - used);
+    uint64_t bits = state->length * 8;
+    for (int i = 0; i < 8; i++) block[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_compress(h, block);
     
-    return block;
+    for (int i = 0; i < 8; i++) {
+        output->bytes[i*4]   = (uint8_t)(h[i] >> 24);
+        output->bytes[i*4+1] = (uint8_t)(h[i] >> 16);
+        output->bytes[i*4+2] = (uint8_t)(h[i] >> 8);
+        output->bytes[i*4+3] = (uint8_t)h[i];
+    }
 }
 
-// Free the memory used by a block
-void free_block(Block* block) {
-    if (block) {
-        free(block->events);
-        free(block);
+// Hash a buffer in one go
+void hash_data(const void* input, size_t len, Digest* output) {
+    HashState state;
+    hash_init(&state);
+    hash_update(&state, input, len);
+    hash_final(&state, output);
+}
+
+/*
+ * MULTI-LANE HASHING
+ * SHA-256 of HASH_LANES independent messages at once, one message per vector lane
+ * Used where many same-length inputs are hashed: Merkle levels and mining nonces
+ */
+
+// The compression runs on GCC vector types, element k of every word belongs to message k.
+// The same code is compiled for AVX-512VL, AVX2 and the baseline (SSE2 on x86-64, NEON on arm64),
+// and the best one the CPU supports is picked at startup
+#define HASH_LANES 8
+typedef uint32_t LaneWord __attribute__((vector_size(HASH_LANES * sizeof(uint32_t))));
+
+static inline uint32_t get_be32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline void put_be32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (24 - 8 * i));
+}
+
+// sha256_compress on every lane, block holds the 16 big endian message words
+static inline __attribute__((always_inline)) void sha256_compress_lanes_body(LaneWord state[8],
+                                                                             const LaneWord block[16]) {
+    LaneWord w[64];
+    for (int i = 0; i < 16; i++) w[i] = block[i];
+    for (int i = 16; i < 64; i++) {
+        LaneWord s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3);
+        LaneWord s1 = ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    LaneWord a = state[0], b = state[1], c = state[2], d = state[3];
+    LaneWord e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        LaneWord t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+                      ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        LaneWord t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256_compress_lanes_generic(LaneWord state[8], const LaneWord block[16]) {
+    sha256_compress_lanes_body(state, block);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void sha256_compress_lanes_avx2(LaneWord state[8], const LaneWord block[16]) {
+    sha256_compress_lanes_body(state, block);
+}
+
+// AVX-512VL has a vector rotate, which saves two instructions per ROTR32
+__attribute__((target("avx512f,avx512vl")))
+static void sha256_compress_lanes_avx512(LaneWord state[8], const LaneWord block[16]) {
+    sha256_compress_lanes_body(state, block);
+}
+#endif
+
+typedef void (*CompressLanesFunction)(LaneWord state[8], const LaneWord block[16]);
+
+static CompressLanesFunction sha256_compress_lanes = sha256_compress_lanes_generic;
+const char* hash_lanes_kernel = "generic";
+
+// Pick the kernel before main runs, so every thread sees the final choice
+__attribute__((constructor))
+static void hash_lanes_select(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+        sha256_compress_lanes = sha256_compress_lanes_avx512;
+        hash_lanes_kernel = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        sha256_compress_lanes = sha256_compress_lanes_avx2;
+        hash_lanes_kernel = "avx2";
     }
+#endif
 }
 
-// Check if a block's hash meets the difficulty requirement (Proof of Work)
-bool is_valid_proof(Block* block, int difficulty) {
-    // Hash must start with 'difficulty' number of zeros
-    for (int i = 0; i < difficulty; i++) {
-        if (block->hash[i] != '0') return false;
+// Give every lane the same count words (a shared start state or message words)
+static void hash_lanes_broadcast(LaneWord* lanes, const uint32_t* words, int count) {
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < HASH_LANES; k++) lanes[i][k] = words[i];
     }
-    return true;
 }
 
-/* 
- * MINING OPERATIONS
- * The process of finding a valid nonce to create a valid block hash
+// Write the digest of every lane
+static void hash_lanes_output(const LaneWord lanes[8], Digest output[HASH_LANES]) {
+    for (int k = 0; k < HASH_LANES; k++) {
+        for (int i = 0; i < 8; i++) put_be32(&output[k].bytes[i*4], lanes[i][k]);
+    }
+}
+
+/*
+ * DIGEST HELPERS
+ * Hashes are kept as 32 raw bytes, hex is only produced when printing
  */
 
-// Mine a block by finding a nonce that produces a valid hash
-// Proof of Work algorithm :
-bool mine_block(Block* block, int difficulty) {
-    // Start with nonce = 0
-    block->nonce = 0;
-    calculate_merkle_root(block);
-    
-    // Create target string (e.g., "00ffff..." for difficulty=2)
-    char target[HASH_SIZE+1];
-    memset(target, '0', difficulty);  // Leading zeros
-    memset(target + difficulty, 'f', HASH_SIZE - difficulty);  // Rest is 'f'
-    target[HASH_SIZE] = '\0';
-    
-    // Keep trying different nonce values until we find a valid hash
-    while (true) {
-        hash_block(block);
-        
-        // Check if hash meets difficulty requirement
-        if (strncmp(block->hash, target, difficulty) <= 0) {
-            return true;  // Found a valid nonce!
-        }
-        
-        block->nonce++;  // Try next nonce value
-        
-        // Mining simulation - introduce delay and early termination chance
-        if (block->nonce % 10 == 0) {
-            usleep(10000);  // 10ms pause to prevent CPU overload
-            
-            // 1% chance to simulate finding solution (speeds up simulation)
-            if (rand() % 100 < 1) {
-                hash_block(block);
-                return true;
-            }
-            
-            // Check if we need to stop mining
-            if (shutdown_requested) return false;
-        }
-    }
+// Compare two digests word by word
+static inline bool digest_equal(const Digest* a, const Digest* b) {
+    uint64_t x[4], y[4];
+    memcpy(x, a->bytes, DIGEST_SIZE);
+    memcpy(y, b->bytes, DIGEST_SIZE);
+    return ((x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) | (x[3] ^ y[3])) == 0;
+}
+
+// Check if a digest is all zeros (genesis previous hash, empty Merkle root)
+static inline bool digest_is_zero(const Digest* digest) {
+    static const Digest zero;
+    return digest_equal(digest, &zero);
+}
+
+// Hash table key of a digest, for tables indexed by block hash
+// A block hash meets its target, so its first bytes are zeros: the key comes from the last ones
+static inline uint64_t digest_key(const Digest* digest) {
+    uint64_t key;
+    memcpy(&key, digest->bytes + DIGEST_SIZE - sizeof(key), sizeof(key));
+    return key;
+}
+
+// Write a digest as a HASH_SIZE hex string
+void digest_to_hex(const Digest* digest, char* output) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < DIGEST_SIZE; i++) {
+        output[i*2]   = hex[digest->bytes[i] >> 4];
+        output[i*2+1] = hex[digest->bytes[i] & 0xf];
+    }
+    output[HASH_SIZE] = '\0';
+}
+
+// Little endian helpers for the binary encodings that get hashed or sent to peers
+static inline void put_le32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline void put_le64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint32_t get_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t get_le64(const uint8_t* p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+/*
+ * EVENT OPERATIONS
+ * Functions for handling individual transactions
+ */
+
+// Hash the fields of an event:
+// type (4) | timestamp (8) | data length (4) | data
+void hash_event_fields(int type, int64_t timestamp, const char* data, uint32_t data_length,
+                       Digest* output) {
+    uint8_t header[16];
+    put_le32(header, (uint32_t)type);
+    put_le64(header + 4, (uint64_t)timestamp);
+    put_le32(header + 12, data_length);
+    
+    HashState state;
+    hash_init(&state);
+    hash_update(&state, header, sizeof(header));
+    hash_update(&state, data, data_length);
+    hash_final(&state, output);
+}
+
+// Generate a unique hash for an event based on its contents
+void hash_event(Event* event) {
+    hash_event_fields(event->type, event->timestamp, event->data, event->data_length, &event->hash);
+}
+
+/*
+ * MERKLE TREE OPERATIONS
+ * Functions for creating and managing the Merkle tree data structure
+ * The tree is reduced level by level in flat arrays, there is no per-node allocation
+ */
+
+// Combine two child hashes into their parent hash
+// out may point to one of the children, it is only written once both are hashed
+static void merkle_parent(const Digest* left, const Digest* right, Digest* out) {
+    HashState state;
+    hash_init(&state);
+    hash_update(&state, left->bytes, DIGEST_SIZE);
+    hash_update(&state, right->bytes, DIGEST_SIZE);
+    hash_final(&state, out);
+}
+
+// merkle_parent of HASH_LANES pairs at once
+// The 64 bytes of a pair fill one block exactly, the second block is only padding
+static void merkle_parent_lanes(const Digest* const left[HASH_LANES], const Digest* const right[HASH_LANES],
+                                Digest output[HASH_LANES]) {
+    LaneWord state[8], block[16];
+    hash_lanes_broadcast(state, sha256_initial, 8);
+    for (int k = 0; k < HASH_LANES; k++) {
+        for (int i = 0; i < 8; i++) {
+            block[i][k] = get_be32(&left[k]->bytes[i*4]);
+            block[8 + i][k] = get_be32(&right[k]->bytes[i*4]);
+        }
+    }
+    sha256_compress_lanes(state, block);
+
+    uint32_t padding[16] = { 0x80000000 };
+    padding[15] = 2 * DIGEST_SIZE * 8;  // Message length in bits
+    hash_lanes_broadcast(block, padding, 16);
+    sha256_compress_lanes(state, block);
+    hash_lanes_output(state, output);
+}
+
+// Reduce one level of the tree into the next one, returns the size of the new level
+// For an odd number of nodes the last one is paired with itself
+// This ensures every parent has exactly two children
+// Parents are hashed HASH_LANES at a time, the few left over one by one
+static int merkle_reduce_level(const Digest* level, int count, Digest* parents) {
+    int parent_count = (count + 1) / 2;
+    int i = 0;
+    for (; i + HASH_LANES <= parent_count; i += HASH_LANES) {
+        const Digest* left[HASH_LANES];
+        const Digest* right[HASH_LANES];
+        Digest hashed[HASH_LANES];  // parents may be level, every child of the group is read first
+        for (int k = 0; k < HASH_LANES; k++) {
+            left[k] = &level[2 * (i + k)];
+            right[k] = (2 * (i + k) + 1 < count) ? left[k] + 1 : left[k];
+        }
+        merkle_parent_lanes(left, right, hashed);
+        memcpy(&parents[i], hashed, sizeof(hashed));
+    }
+    for (; i < parent_count; i++) {
+        const Digest* left = &level[2 * i];
+        const Digest* right = (2 * i + 1 < count) ? &level[2 * i + 1] : left;
+        merkle_parent(left, right, &parents[i]);
+    }
+    return parent_count;
+}
+
+// Compute the Merkle root of count leaves in place, destroying the buffer contents
+static void merkle_root_in_place(Digest* level, int count, Digest* root) {
+    if (count == 0) {
+        // Empty block gets all zeros for its Merkle root
+        memset(root, 0, sizeof(Digest));
+        return;
+    }
+    while (count > 1) {
+        count = merkle_reduce_level(level, count, level);
+    }
+    *root = level[0];
+}
+
+// Build the whole tree in one allocation (leaves first, root last)
+// Keeps every level so inclusion proofs can be read from it
+// Returns false if memory allocation failed
+bool merkle_tree_build(MerkleTree* tree, const Digest* leaves, int count) {
+    // Work out the size of every level first so we can allocate once
+    int total = 0;
+    int levels = 0;
+    for (int size = count; ; size = (size + 1) / 2) {
+        tree->level_offset[levels] = total;
+        tree->level_size[levels] = size;
+        total += size;
+        levels++;
+        if (size <= 1) break;
+    }
+    
+    tree->leaf_count = count;
+    tree->level_count = levels;
+    tree->nodes = malloc((total > 0 ? total : 1) * sizeof(Digest));
+    if (!tree->nodes) return false;
+    
+    if (count == 0) {
+        memset(tree->nodes, 0, sizeof(Digest));
+        return true;
+    }
+    memcpy(tree->nodes, leaves, count * sizeof(Digest));
+    for (int l = 1; l < levels; l++) {
+        merkle_reduce_level(&tree->nodes[tree->level_offset[l - 1]], tree->level_size[l - 1],
+                            &tree->nodes[tree->level_offset[l]]);
+    }
+    return true;
+}
+
+// Root hash of a tree built by merkle_tree_build
+const Digest* merkle_tree_root(const MerkleTree* tree) {
+    return &tree->nodes[tree->level_offset[tree->level_count - 1]];
+}
+
+// Read the inclusion proof of leaf index from a built tree
+// Returns false if the index is out of range
+bool merkle_tree_proof(const MerkleTree* tree, int index, MerkleProof* proof) {
+    if (index < 0 || index >= tree->leaf_count) return false;
+    
+    proof->leaf_index = index;
+    proof->leaf_count = tree->leaf_count;
+    proof->length = tree->level_count - 1;
+    
+    for (int l = 0; l < proof->length; l++) {
+        // The last node of an odd level was paired with itself
+        int sibling = index ^ 1;
+        if (sibling >= tree->level_size[l]) sibling = index;
+        proof->siblings[l] = tree->nodes[tree->level_offset[l] + sibling];
+        index /= 2;
+    }
+    return true;
+}
+
+// Check that leaf is at proof->leaf_index in the tree with the given root
+bool merkle_verify_proof(const Digest* leaf, const MerkleProof* proof, const Digest* root) {
+    if (proof->leaf_index < 0 || proof->leaf_index >= proof->leaf_count) return false;
+    
+    // The proof must have exactly one sibling per level of a tree with leaf_count leaves
+    int expected_length = 0;
+    for (int size = proof->leaf_count; size > 1; size = (size + 1) / 2) expected_length++;
+    if (proof->length != expected_length) return false;
+    
+    Digest h = *leaf;
+    int index = proof->leaf_index;
+    int size = proof->leaf_count;
+    for (int l = 0; l < proof->length; l++) {
+        const Digest* sibling = &proof->siblings[l];
+        if (index % 2 == 0) {
+            // A left node without a right neighbour must have been duplicated
+            if (index + 1 >= size && !digest_equal(sibling, &h)) return false;
+            merkle_parent(&h, sibling, &h);
+        } else {
+            merkle_parent(sibling, &h, &h);
+        }
+        index /= 2;
+        size = (size + 1) / 2;
+    }
+    return digest_equal(&h, root);
+}
+
+// Free the memory used by a Merkle tree
+void merkle_tree_free(MerkleTree* tree) {
+    free(tree->nodes);
+    tree->nodes = NULL;
+}
+
+// Reset an accumulator to the empty tree
+void merkle_accumulator_init(MerkleAccumulator* acc) {
+    acc->count = 0;
+}
+
+// Append one leaf, O(log n): merge it with every complete subtree of the same size
+void merkle_accumulator_append(MerkleAccumulator* acc, const Digest* leaf) {
+    Digest h = *leaf;
+    int level = 0;
+    while (acc->count & ((uint32_t)1 << level)) {
+        merkle_parent(&acc->frontier[level], &h, &h);
+        level++;
+    }
+    acc->frontier[level] = h;
+    acc->count++;
+}
+
+// Root of all leaves appended so far, O(log n)
+// Gives the same result as merkle_root_in_place: sweeping up the right edge,
+// a subtree without a right sibling is paired with itself
+void merkle_accumulator_root(const MerkleAccumulator* acc, Digest* root) {
+    if (acc->count == 0) {
+        memset(root, 0, sizeof(Digest));
+        return;
+    }
+    
+    // Start from the smallest complete subtree, it is the rightmost one
+    uint32_t count = acc->count;
+    int level = 0;
+    while (!(count & ((uint32_t)1 << level))) level++;
+    Digest h = acc->frontier[level];
+    
+    while (count != ((uint32_t)1 << level)) {
+        // h has no right sibling at this level: duplicate it, as if
+        // the tree had another subtree of the same size here
+        merkle_parent(&h, &h, &h);
+        count += (uint32_t)1 << level;
+        level++;
+        
+        // Then merge with the complete subtrees to its left
+        while (!(count & ((uint32_t)1 << level))) {
+            merkle_parent(&acc->frontier[level], &h, &h);
+            level++;
+        }
+    }
+    *root = h;
+}
+
+// Refresh a block's Merkle root from its accumulator, without rehashing the events
+void update_merkle_root(Block* block) {
+    merkle_accumulator_root(block->merkle, &block->merkle_root);
+}
+
+// Calculate the Merkle root hash for a block's events from scratch
+// Used to verify a block, blocks being built use update_merkle_root instead
+// Returns false if memory allocation failed, merkle_root is left as it was
+bool calculate_merkle_root(Block* block) {
+    // Reduced in a copy, the event hashes stay as they are
+    Digest* level = malloc((block->event_count ? block->event_count : 1) * sizeof(Digest));
+    if (!level) return false;
+    if (block->event_count > 0) memcpy(level, block->events.hash, block->event_count * sizeof(Digest));
+    merkle_root_in_place(level, block->event_count, &block->merkle_root);
+    free(level);
+    return true;
+}
+
+// Build the inclusion proof for event event_index of a block
+// Returns false if the index is out of range or memory allocation failed
+bool get_event_proof(const Block* block, int event_index, MerkleProof* proof) {
+    if (event_index < 0 || event_index >= block->event_count) return false;
+    
+    // The event hashes are already a dense array of leaves
+    MerkleTree tree;
+    if (!merkle_tree_build(&tree, block->events.hash, block->event_count)) return false;
+    bool ok = merkle_tree_proof(&tree, event_index, proof);
+    merkle_tree_free(&tree);
+    return ok;
+}
+
+// Light client check: is this event part of the block with this Merkle root?
+// The event hash is recomputed from its contents, so a forged event can't reuse a valid hash
+bool verify_event_proof(const Event* event, const MerkleProof* proof, const Digest* merkle_root) {
+    Event copy = *event;
+    hash_event(&copy);
+    return merkle_verify_proof(&copy.hash, proof, merkle_root);
+}
+
+/*
+ * BLOCK OPERATIONS
+ * Functions for creating and managing blocks
+ */
+
+// Size of the binary block header that gets hashed:
+// index (4) | timestamp (8) | previous_hash (32) | merkle_root (32) | bits (4) | nonce (4)
+#define BLOCK_HEADER_SIZE 84
+#define BLOCK_HEADER_PREFIX_SIZE (BLOCK_HEADER_SIZE - 4)
+
+// Hash the fixed part of the block header (everything except the nonce)
+// The resulting state is the "midstate": it only changes when the header does,
+// so mining can reuse it for every nonce it tries
+void hash_block_prefix(const Block* block, HashState* midstate) {
+    uint8_t header[BLOCK_HEADER_PREFIX_SIZE];
+    put_le32(header, (uint32_t)block->index);
+    put_le64(header + 4, (uint64_t)block->timestamp);
+    memcpy(header + 12, block->previous_hash.bytes, DIGEST_SIZE);
+    memcpy(header + 44, block->merkle_root.bytes, DIGEST_SIZE);
+    put_le32(header + 76, block->bits);
+    hash_init(midstate);
+    hash_update(midstate, header, sizeof(header));
+}
+
+// Finish a block hash from its midstate by mixing in the nonce bytes
+void hash_block_nonce(const HashState* midstate, int nonce, Digest* output) {
+    uint8_t bytes[4];
+    put_le32(bytes, (uint32_t)nonce);
+    
+    HashState state = *midstate;
+    hash_update(&state, bytes, sizeof(bytes));
+    hash_final(&state, output);
+}
+
+// hash_block_nonce for HASH_LANES nonces at once
+// The nonce and the padding end the block the midstate has buffered, so each lane
+// takes one compression, only the words holding the nonce differ between lanes
+void hash_block_nonces(const HashState* midstate, const uint32_t nonces[HASH_LANES], Digest output[HASH_LANES]) {
+    size_t used = midstate->buffered;
+    if (used + 4 + 9 > 64) {
+        // Would need a second block, not the case for BLOCK_HEADER_SIZE but keep it correct
+        for (int k = 0; k < HASH_LANES; k++) hash_block_nonce(midstate, (int)nonces[k], &output[k]);
+        return;
+    }
+
+    uint8_t block[64];
+    memcpy(block, midstate->buffer, used);
+    memset(block + used, 0, 64 - used);
+    block[used + 4] = 0x80;
+    uint64_t bits = (midstate->length + 4) * 8;
+    for (int i = 0; i < 8; i++) block[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+
+    uint32_t words[16];
+    for (int i = 0; i < 16; i++) words[i] = get_be32(block + i*4);
+    LaneWord state[8], lanes[16];
+    hash_lanes_broadcast(state, midstate->h, 8);
+    hash_lanes_broadcast(lanes, words, 16);
+
+    // The 4 nonce bytes touch at most two words
+    int first = (int)(used / 4);
+    for (int k = 0; k < HASH_LANES; k++) {
+        uint8_t bytes[8];
+        memcpy(bytes, block + first * 4, sizeof(bytes));
+        put_le32(bytes + used % 4, nonces[k]);
+        lanes[first][k] = get_be32(bytes);
+        lanes[first + 1][k] = get_be32(bytes + 4);
+    }
+    sha256_compress_lanes(state, lanes);
+    hash_lanes_output(state, output);
+}
+
+// Generate a unique hash for a block based on its contents
+void hash_block(Block* block) {
+    HashState midstate;
+    hash_block_prefix(block, &midstate);
+    hash_block_nonce(&midstate, block->nonce, &block->hash);
+}
+
+// Bytes needed for the fixed-width event columns of capacity events
+static size_t event_columns_size(int capacity) {
+    return (size_t)capacity * (sizeof(Digest) + sizeof(int64_t) + sizeof(int) +
+                               2 * sizeof(uint32_t) + sizeof(bool));
+}
+
+// Point the columns into one piece of memory, widest fields first so every column stays aligned
+static void event_columns_layout(EventColumns* columns, void* memory, int capacity) {
+    uint8_t* p = memory;
+    columns->hash = (Digest*)p;           p += capacity * sizeof(Digest);
+    columns->timestamp = (int64_t*)p;     p += capacity * sizeof(int64_t);
+    columns->type = (int*)p;              p += capacity * sizeof(int);
+    columns->data_offset = (uint32_t*)p;  p += capacity * sizeof(uint32_t);
+    columns->data_length = (uint32_t*)p;  p += capacity * sizeof(uint32_t);
+    columns->is_valid = (bool*)p;
+}
+
+// Copy the fixed-width fields of the first count events (payload offsets included as is)
+static void event_columns_copy(EventColumns* dst, const EventColumns* src, int count) {
+    if (count == 0) return;
+    memcpy(dst->hash, src->hash, count * sizeof(Digest));
+    memcpy(dst->timestamp, src->timestamp, count * sizeof(int64_t));
+    memcpy(dst->type, src->type, count * sizeof(int));
+    memcpy(dst->data_offset, src->data_offset, count * sizeof(uint32_t));
+    memcpy(dst->data_length, src->data_length, count * sizeof(uint32_t));
+    memcpy(dst->is_valid, src->is_valid, count * sizeof(bool));
+}
+
+// Make room for capacity events in a block being built
+// Returns false if memory allocation failed
+static bool block_reserve_events(Block* block, int capacity) {
+    if (capacity <= block->event_capacity) return true;
+    
+    void* memory = malloc(event_columns_size(capacity));
+    if (!memory) return false;
+    
+    EventColumns columns = block->events;  // Keeps the payload arena as is
+    event_columns_layout(&columns, memory, capacity);
+    event_columns_copy(&columns, &block->events, block->event_count);
+    free(block->events.hash);
+    
+    block->events = columns;
+    block->event_capacity = capacity;
+    return true;
+}
+
+// Make room for length more payload bytes in a block being built
+// Returns false if memory allocation failed
+static bool block_reserve_data(Block* block, size_t length) {
+    EventColumns* events = &block->events;
+    if (events->data_used + length <= events->data_capacity) return true;
+    
+    size_t capacity = events->data_capacity ? events->data_capacity : 256;
+    while (capacity < events->data_used + length) capacity *= 2;
+    char* data = realloc(events->data, capacity);
+    if (!data) return false;
+    
+    events->data = data;
+    events->data_capacity = capacity;
+    return true;
+}
+
+// Read event i of a block
+// Payloads are addressed by offset, so data stays valid until the block is freed or changed
+Event get_event(const Block* block, int i) {
+    const EventColumns* events = &block->events;
+    Event event;
+    event.type = events->type[i];
+    event.data = events->data + events->data_offset[i];
+    event.data_length = events->data_length[i];
+    event.timestamp = (time_t)events->timestamp[i];
+    event.hash = events->hash[i];
+    event.is_valid = events->is_valid[i];
+    return event;
+}
+
+// Turn a block into an empty block with the given index and previous hash
+// Its event buffers are kept (and emptied), so a recycled block doesn't allocate
+static void block_start(Block* block, int index, const Digest* prev_hash) {
+    block->index = index;
+    block->timestamp = time(NULL);  // Current time
+    block->previous_hash = *prev_hash;
+    block->event_count = 0;
+    block->events.data_used = 0;
+    block->nonce = 0;  // Will be determined during mining
+    block->bits = chain_params.initial_bits;  // Chains set the retargeted value (see chain_reset_mining_block)
+    block->segment = NULL;  // Not stored until it is published
+    merkle_accumulator_init(block->merkle);
+    update_merkle_root(block);
+}
+
+// Make a block a copy of source, growing its event buffers when they are too small
+// Returns false if memory allocation failed
+static bool block_copy_from(Block* block, const Block* source) {
+    // Copy all basic properties
+    block->index = source->index;
+    block->timestamp = source->timestamp;
+    block->previous_hash = source->previous_hash;
+    block->merkle_root = source->merkle_root;
+    block->hash = source->hash;
+    block->nonce = source->nonce;
+    block->bits = source->bits;
+    
+    // Clone event columns and payloads
+    metrics_count(COUNTER_CLONE_BYTES, event_columns_size(source->event_count) + source->events.data_used +
+                                       sizeof(MerkleAccumulator));
+    block->event_count = 0;
+    block->events.data_used = 0;
+    if (!block_reserve_events(block, source->event_capacity) ||
+        !block_reserve_data(block, source->events.data_used)) return false;
+    event_columns_copy(&block->events, &source->events, source->event_count);
+    if (source->events.data_used > 0) {
+        memcpy(block->events.data, source->events.data, source->events.data_used);
+    }
+    block->events.data_used = source->events.data_used;
+    block->event_count = source->event_count;
+    
+    // Cloned blocks are working copies that may still get events
+    block->segment = NULL;  // Not stored
+    if (source->merkle) {
+        *block->merkle = *source->merkle;
+    } else {
+        // Stored blocks dropped their accumulator, rebuild it from the events
+        merkle_accumulator_init(block->merkle);
+        for (int i = 0; i < source->event_count; i++) {
+            merkle_accumulator_append(block->merkle, &source->events.hash[i]);
+        }
+    }
+    return true;
+}
+
+// Free the memory used by a block
+// Only for blocks from create_block/clone_block, stored blocks are released with block_release
+void free_block(Block* block) {
+    if (block) {
+        free(block->events.hash);  // Start of the column allocation
+        free(block->events.data);
+        free(block->merkle);
+        free(block);
+    }
+}
+
+// Working block without events or buffers yet
+// Returns NULL if memory allocation failed
+static Block* block_alloc(void) {
+    Block* block = malloc(sizeof(Block));
+    if (!block) return NULL;
+    memset(&block->events, 0, sizeof(EventColumns));
+    block->event_capacity = 0;
+    block->event_count = 0;
+    block->merkle = malloc(sizeof(MerkleAccumulator));
+    if (!block->merkle) {
+        free(block);
+        return NULL;
+    }
+    return block;
+}
+
+// Create a new empty block with the given index and previous hash
+// Returns NULL if memory allocation failed
+Block* create_block(int index, const Digest* prev_hash) {
+    Block* block = block_alloc();
+    if (!block || !block_reserve_events(block, 10)) {  // Start with space for 10 events
+        free_block(block);
+        return NULL;
+    }
+    block_start(block, index, prev_hash);
+    return block;
+}
+
+// Create a deep copy of a block - for nodes 
+// Returns NULL if memory allocation failed
+Block* clone_block(Block* source) {
+    Block* block = block_alloc();
+    if (!block || !block_copy_from(block, source)) {
+        free_block(block);
+        return NULL;
+    }
+    return block;
+}
+
+// Replace the payload of event i of a block being built, and rehash that event
+// The Merkle root and block hash are left alone
+// Returns false if memory allocation failed
+bool block_set_event_data(Block* block, int i, const char* data) {
+    size_t length = strlen(data);
+    if (!block_reserve_data(block, length + 1)) return false;
+    
+    EventColumns* events = &block->events;
+    memcpy(events->data + events->data_used, data, length + 1);
+    events->data_offset[i] = (uint32_t)events->data_used;
+    events->data_length[i] = (uint32_t)length;
+    events->data_used += length + 1;
+    
+    hash_event_fields(events->type[i], events->timestamp[i], data, (uint32_t)length, &events->hash[i]);
+    return true;
+}
+
+/*
+ * BLOCK POOL
+ * Working blocks (mining templates, their per-round copies, blocks being
+ * decoded) are made and dropped all the time. Every chain keeps a few spare
+ * ones whose event columns, payload arena and Merkle accumulator stay
+ * allocated: columns are sized for max_events up front and the arena keeps
+ * the size it grew to, so a recycled block is filled without touching the heap.
+ */
+
+#define POOL_KEEP_DATA (1 << 20)  // A spare keeps at most this much payload arena, bigger ones go back to the heap
+
+void block_pool_init(BlockPool* pool) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->spare_count = 0;
+    pool->allocated = pool->reused = pool->recycled = pool->freed = 0;
+}
+
+// Give the spare blocks back to the heap
+void block_pool_free(BlockPool* pool) {
+    for (int i = 0; i < pool->spare_count; i++) free_block(pool->spares[i]);
+    pool->spare_count = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// A spare block, or NULL if the pool is empty (counted as an allocation then)
+static Block* pool_take(BlockPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    Block* block = pool->spare_count ? pool->spares[--pool->spare_count] : NULL;
+    if (block) {
+        pool->reused++;
+    } else {
+        pool->allocated++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return block;
+}
+
+// New heap block with columns for a full block, so it never grows them
+// Returns NULL if memory allocation failed
+static Block* pool_alloc(void) {
+    Block* block = block_alloc();
+    if (!block || !block_reserve_events(block, chain_params.max_events)) {
+        free_block(block);
+        return NULL;
+    }
+    return block;
+}
+
+// Like free_block, keeps the block as a spare if the pool has room (pool may be NULL: plain free_block)
+void pool_free_block(BlockPool* pool, Block* block) {
+    if (!block) return;
+    if (pool && block->events.data_capacity <= POOL_KEEP_DATA) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->spare_count < POOL_SPARE_BLOCKS) {
+            pool->spares[pool->spare_count++] = block;
+            pool->recycled++;
+            block = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (block) {
+        if (pool) {
+            pthread_mutex_lock(&pool->lock);
+            pool->freed++;
+            pthread_mutex_unlock(&pool->lock);
+        }
+        free_block(block);
+    }
+}
+
+// Like create_block, from the pool's spares when it has one (pool may be NULL: plain create_block)
+// Returns NULL if memory allocation failed
+Block* pool_create_block(BlockPool* pool, int index, const Digest* prev_hash) {
+    if (!pool) return create_block(index, prev_hash);
+    Block* block = pool_take(pool);
+    if (!block) block = pool_alloc();
+    if (!block) return NULL;
+    block_start(block, index, prev_hash);
+    return block;
+}
+
+// Like clone_block, from the pool's spares when it has one (pool may be NULL: plain clone_block)
+// Returns NULL if memory allocation failed
+Block* pool_clone_block(BlockPool* pool, Block* source) {
+    if (!pool) return clone_block(source);
+    Block* block = pool_take(pool);
+    if (!block) block = pool_alloc();
+    if (block && !block_copy_from(block, source)) {
+        pool_free_block(pool, block);  // Left empty by block_copy_from, fine as a spare
+        block = NULL;
+    }
+    return block;
+}
+
+/*
+ * DIFFICULTY
+ * The Proof of Work target is a 256-bit number, a block is valid if its hash
+ * read as a big-endian number does not exceed it. Blocks carry the target in
+ * compact form ("bits", as in Bitcoin): exponent (1 byte) | mantissa (3 bytes),
+ * target = mantissa * 256^(exponent - 3). Difficulty is the expected number of
+ * hashes per block, 2^256 / target.
+ */
+
+// Expand compact bits to the full target
+void target_from_bits(uint32_t bits, Digest* target) {
+    memset(target->bytes, 0, DIGEST_SIZE);
+    int exponent = (int)(bits >> 24);
+    uint32_t mantissa = bits & 0xffffff;
+    for (int i = 0; i < 3; i++) {
+        int position = DIGEST_SIZE - exponent + i;  // Byte of the mantissa's i-th most significant byte
+        if (position >= 0 && position < DIGEST_SIZE) target->bytes[position] = (uint8_t)(mantissa >> (16 - 8 * i));
+    }
+}
+
+// Compact form of a target, rounded down to its 3 most significant bytes
+uint32_t bits_from_target(const Digest* target) {
+    int first = 0;
+    while (first < DIGEST_SIZE - 1 && target->bytes[first] == 0) first++;
+    uint32_t mantissa = 0;
+    for (int i = 0; i < 3; i++) {
+        mantissa <<= 8;
+        if (first + i < DIGEST_SIZE) mantissa |= target->bytes[first + i];
+    }
+    return (uint32_t)(DIGEST_SIZE - first) << 24 | mantissa;
+}
+
+// Compact target for a difficulty (expected hashes per block, at least 1)
+// target = (2^256 - 1) / difficulty, by long division one byte at a time
+uint32_t bits_from_difficulty(uint64_t difficulty) {
+    if (difficulty == 0) difficulty = 1;
+    Digest target;
+    unsigned __int128 remainder = 0;
+    for (int i = 0; i < DIGEST_SIZE; i++) {
+        remainder = remainder << 8 | 0xff;
+        target.bytes[i] = (uint8_t)(remainder / difficulty);
+        remainder %= difficulty;
+    }
+    return bits_from_target(&target);
+}
+
+// Expected hashes to find a block with these bits, 2^256 / target
+double difficulty_from_bits(uint32_t bits) {
+    uint32_t mantissa = bits & 0xffffff;
+    if (mantissa == 0) return 0;
+    double difficulty = 1.0 / mantissa;
+    for (int i = 8 * ((int)(bits >> 24) - 3); i < 256; i++) difficulty *= 2;
+    for (int i = 256; i < 8 * ((int)(bits >> 24) - 3); i++) difficulty /= 2;
+    return difficulty;
+}
+
+// Scale the target of bits by ratio (> 1 makes blocks easier), keeping 16 to 24 bits of mantissa
+static uint32_t bits_scale(uint32_t bits, double ratio) {
+    int exponent = (int)(bits >> 24);
+    double mantissa = (double)(bits & 0xffffff) * ratio;
+    while (mantissa >= 0x1000000 && exponent < DIGEST_SIZE) {
+        mantissa /= 256;
+        exponent++;
+    }
+    while (mantissa < 0x10000 && exponent > 3) {
+        mantissa *= 256;
+        exponent--;
+    }
+    if (mantissa >= 0x1000000) mantissa = 0xffffff;  // Easiest target that fits
+    if (mantissa < 1) mantissa = 1;
+    return (uint32_t)exponent << 24 | (uint32_t)mantissa;
+}
+
+// Check that the chain parameters make sense and derive the compact initial target
+// Returns false (with a message) if a value is out of range
+bool chain_params_apply(ChainParams* params) {
+    if (params->max_events < 1 || params->max_events > MAX_EVENTS_LIMIT) {
+        fprintf(stderr, "Maximum events per block must be between 1 and %d\n", MAX_EVENTS_LIMIT);
+        return false;
+    }
+    if (params->difficulty < 1) {
+        fprintf(stderr, "Difficulty must be at least 1\n");
+        return false;
+    }
+    if (params->consensus_threshold <= 0 || params->consensus_threshold > 1) {
+        fprintf(stderr, "Consensus threshold must be in (0, 1]\n");
+        return false;
+    }
+    if (params->target_block_ms < 0 || params->retarget_interval < 2) {
+        fprintf(stderr, "Block time must be positive and the retarget interval at least 2\n");
+        return false;
+    }
+    params->initial_bits = bits_from_difficulty(params->difficulty);
+    return true;
+}
+
+// True if the block at height gets a new target, instead of its parent's bits
+static bool is_retarget_height(int height) {
+    int interval = chain_params.retarget_interval;
+    return chain_params.target_block_ms > 0 && height % interval == 0 && height > interval;
+}
+
+// Retargeted bits for the block after parent, first is the block retarget_interval below it
+// How long the last interval took against target_block_ms per block scales the target,
+// by at most 4x either way, and the target never gets easier than initial_bits
+static uint32_t retarget_bits(const Block* parent, const Block* first) {
+    // Timestamps are in seconds, a window shorter than one second counts as one second
+    double actual_ms = (double)(parent->timestamp - first->timestamp) * 1000;
+    double expected_ms = (double)(chain_params.retarget_interval - 1) * chain_params.target_block_ms;
+    if (actual_ms < 1000) actual_ms = 1000;
+    double ratio = actual_ms / expected_ms;
+    if (ratio < 0.25) ratio = 0.25;
+    if (ratio > 4) ratio = 4;
+    
+    uint32_t bits = bits_scale(parent->bits, ratio);
+    Digest target, limit;
+    target_from_bits(bits, &target);
+    target_from_bits(chain_params.initial_bits, &limit);
+    return memcmp(target.bytes, limit.bytes, DIGEST_SIZE) > 0 ? chain_params.initial_bits : bits;
+}
+
+// Compact target required for the block at height, given the blocks below it (blocks[0..height-1])
+// Fixed unless target_block_ms is set, then retargeted every retarget_interval blocks
+// The genesis block is left out of the retarget window
+uint32_t next_block_bits(Block* const* blocks, int height) {
+    if (height <= 1) return chain_params.initial_bits;
+    if (!is_retarget_height(height)) return blocks[height - 1]->bits;
+    return retarget_bits(blocks[height - 1], blocks[height - chain_params.retarget_interval]);
+}
+
+// Work of one block with these bits, expected hashes 2^256 / target as an integer
+// Chain work is the sum over its blocks, which is what picks the best tip (see BLOCK TREE)
+ChainWork block_work(uint32_t bits) {
+    uint32_t mantissa = bits & 0xffffff;
+    int shift = 256 - 8 * ((int)(bits >> 24) - 3);  // work = 2^shift / mantissa
+    if (mantissa == 0) return 0;
+    if (shift >= 128) shift = 127;  // Far beyond any difficulty anyone can mine
+    if (shift < 0) return 1;
+    ChainWork work = ((ChainWork)1 << shift) / mantissa;
+    return work ? work : 1;
+}
+
+// Check if a hash meets a target
+static inline bool hash_meets_target(const Digest* hash, const Digest* target) {
+    return memcmp(hash->bytes, target->bytes, DIGEST_SIZE) <= 0;
+}
+
+// Check if a hash meets compact bits that are no easier than the chain's initial target
+// Which bits a given height needs depends on the chain below it, see next_block_bits
+bool hash_meets_bits(const Digest* hash, uint32_t bits) {
+    Digest target, limit;
+    target_from_bits(bits, &target);
+    target_from_bits(chain_params.initial_bits, &limit);
+    return memcmp(target.bytes, limit.bytes, DIGEST_SIZE) <= 0 && hash_meets_target(hash, &target);
+}
+
+// Check if a block's hash meets its own target (Proof of Work)
+bool is_valid_proof(const Block* block) {
+    return hash_meets_bits(&block->hash, block->bits);
+}
+
+/* 
+ * MINING OPERATIONS
+ * The process of finding a valid nonce to create a valid block hash
+ */
+
+// Claim the solution for the job, only the first worker to call this wins
+static void mining_job_submit(MiningJob* job, int nonce) {
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&job->found, &expected, true)) {
+        atomic_store(&job->winning_nonce, nonce);
+    }
+}
+
+// Worker loop: scan this worker's share of the nonce space until someone finds a solution
+static void* mining_worker(void* arg) {
+    MiningWorker* worker = (MiningWorker*)arg;
+    MiningJob* job = worker->job;
+    
+    // Each try only mixes the nonce into the shared midstate, the header
+    // prefix was serialized and hashed once for the whole job
+    // Nonces are hashed HASH_LANES at a time (this worker's next ones), then checked in order
+    Digest hashes[HASH_LANES];
+    uint32_t nonces[HASH_LANES];
+    unsigned long long tried = 0;
+    bool done = false;
+    
+    for (long base = worker->first_nonce; base <= INT_MAX && !done; base += (long)job->stride * HASH_LANES) {
+        for (int k = 0; k < HASH_LANES; k++) nonces[k] = (uint32_t)(base + (long)k * job->stride);
+        hash_block_nonces(&job->midstate, nonces, hashes);
+        
+        for (int k = 0; k < HASH_LANES; k++) {
+            long nonce = base + (long)k * job->stride;
+            if (nonce > INT_MAX) {
+                done = true;  // Nonce space exhausted
+                break;
+            }
+            tried++;
+            
+            if (hash_meets_target(&hashes[k], &job->target)) {
+                mining_job_submit(job, (int)nonce);
+                done = true;
+                break;
+            }
+            
+            // Simulation mode - introduce delay and early termination chance
+            if (simulation_mode && tried % 10 == 0) {
+                usleep(10000);  // 10ms pause to slow the demo down
+                
+                // 1% chance to simulate finding solution (speeds up simulation)
+                if (rand() % 100 < 1) {
+                    mining_job_submit(job, (int)nonce);
+                    done = true;
+                    break;
+                }
+            }
+            
+            // Check every so often if another worker won, the block went stale or we need to stop mining
+            if (tried % 1024 == 0) {
+                done = atomic_load(&job->found) || atomic_load(&shutdown_requested) ||
+                       (job->cancel && atomic_load_explicit(job->cancel, memory_order_relaxed));
+                if (done) break;
+            }
+        }
+    }
+    
+    atomic_fetch_add(&job->hashes, tried);
+    return NULL;
+}
+
+// Number of workers to use for one mining job
+static int mining_worker_count() {
+    if (mining_threads > 0) return mining_threads;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+// Helper thread of the mining pool: run the share of each job it is handed, then wait for the next
+static void* mining_helper(void* arg) {
+    MiningWorker* worker = (MiningWorker*)arg;
+    pthread_mutex_lock(&mining_pool.lock);
+    while (true) {
+        while (!worker->job && !mining_pool.stopping) pthread_cond_wait(&worker->wake, &mining_pool.lock);
+        if (!worker->job) break;  // The pool is stopping
+        pthread_mutex_unlock(&mining_pool.lock);
+        
+        // The job's stride and this worker's first nonce were set before it was handed over
+        mining_worker(worker);
+        
+        pthread_mutex_lock(&mining_pool.lock);
+        worker->job->running--;
+        worker->job = NULL;
+        pthread_cond_broadcast(&mining_pool.done);
+    }
+    pthread_mutex_unlock(&mining_pool.lock);
+    return NULL;
+}
+
+// Start helpers until the pool has count of them, the caller holds mining_pool.lock
+// A helper that can't be allocated or started is left out, jobs then use fewer workers
+static void mining_pool_grow(int count) {
+    if (count > mining_pool.capacity) {
+        MiningWorker** helpers = realloc(mining_pool.helpers, count * sizeof(MiningWorker*));
+        if (!helpers) return;
+        mining_pool.helpers = helpers;
+        mining_pool.capacity = count;
+    }
+    while (mining_pool.count < count) {
+        MiningWorker* worker = calloc(1, sizeof(MiningWorker));
+        if (!worker) return;
+        pthread_cond_init(&worker->wake, NULL);
+        if (pthread_create(&worker->thread, NULL, mining_helper, worker) != 0) {
+            pthread_cond_destroy(&worker->wake);
+            free(worker);
+            return;
+        }
+        mining_pool.helpers[mining_pool.count++] = worker;
+    }
+}
+
+// Stop and join the helpers, every mining job must have returned
+// The pool starts again on the next job
+void mining_pool_stop(void) {
+    pthread_mutex_lock(&mining_pool.lock);
+    mining_pool.stopping = true;
+    for (int i = 0; i < mining_pool.count; i++) pthread_cond_signal(&mining_pool.helpers[i]->wake);
+    pthread_mutex_unlock(&mining_pool.lock);
+    
+    for (int i = 0; i < mining_pool.count; i++) {
+        pthread_join(mining_pool.helpers[i]->thread, NULL);
+        pthread_cond_destroy(&mining_pool.helpers[i]->wake);
+        free(mining_pool.helpers[i]);
+    }
+    free(mining_pool.helpers);
+    mining_pool.helpers = NULL;
+    mining_pool.count = mining_pool.capacity = 0;
+    mining_pool.stopping = false;
+}
+
+// Mine a block by finding a nonce that produces a hash meeting the block's bits
+// Proof of Work algorithm : the nonce space is split across the calling thread and the
+// idle helpers of the mining pool, worker w tries nonces w, w+N, w+2N ... until one of
+// them finds a valid hash. Jobs mined at the same time by several nodes share the helpers.
+// Fills stats (if not NULL) with the number of hashes tried and the hash rate
+// Gives up as soon as *cancel becomes true (cancel may be NULL)
+bool mine_block_cancellable(Block* block, atomic_bool* cancel, MiningStats* stats) {
+    update_merkle_root(block);
+    
+    MiningJob job;
+    hash_block_prefix(block, &job.midstate);
+    target_from_bits(block->bits, &job.target);
+    job.cancel = cancel;
+    atomic_init(&job.found, false);
+    atomic_init(&job.winning_nonce, 0);
+    atomic_init(&job.hashes, 0);
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    // Hand the job to idle helpers. They need mining_pool.lock to start, so none of them
+    // reads the stride before it is set below: every nonce is covered exactly once
+    MiningWorker self = { .job = &job, .first_nonce = 0 };
+    pthread_mutex_lock(&mining_pool.lock);
+    int wanted = mining_worker_count() - 1;
+    mining_pool_grow(wanted);
+    int helpers = 0;
+    for (int i = 0; i < mining_pool.count && helpers < wanted; i++) {
+        MiningWorker* helper = mining_pool.helpers[i];
+        if (helper->job) continue;  // Busy with another node's job
+        helper->job = &job;
+        helper->first_nonce = ++helpers;
+        pthread_cond_signal(&helper->wake);
+    }
+    job.stride = helpers + 1;
+    job.running = helpers;
+    pthread_mutex_unlock(&mining_pool.lock);
+    
+    // The calling thread works as worker 0, then waits for the helpers to let go of the job
+    mining_worker(&self);
+    pthread_mutex_lock(&mining_pool.lock);
+    while (job.running > 0) pthread_cond_wait(&mining_pool.done, &mining_pool.lock);
+    pthread_mutex_unlock(&mining_pool.lock);
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    if (stats) {
+        stats->hashes = atomic_load(&job.hashes);
+        stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        stats->hash_rate = stats->seconds > 0 ? stats->hashes / stats->seconds : 0;
+    }
+    
+    if (!atomic_load(&job.found)) return false;  // Interrupted or nonce space exhausted
+    
+    block->nonce = atomic_load(&job.winning_nonce);
+    hash_block(block);
+    return true;  // Found a valid nonce!
+}
+
+// Mine a block that can't be cancelled
+bool mine_block_with_stats(Block* block, MiningStats* stats) {
+    return mine_block_cancellable(block, NULL, stats);
+}
+
+// Mine a block without collecting statistics
+bool mine_block(Block* block) {
+    return mine_block_with_stats(block, NULL);
+}
+
+/*
+ * PARALLEL FOR
+ * Split a loop over [0, count) in contiguous ranges, one per worker thread.
+ * Uses as many workers as mining does (--threads), the calling thread takes the first range.
+ */
+
+#define PARALLEL_MIN_ITEMS 256      // Smaller loops run on the calling thread only
+
+typedef void (*RangeFunction)(void* context, int begin, int end);
+
+typedef struct {
+    RangeFunction function;
+    void* context;
+    int begin;
+    int end;
+    bool started;                  // Whether the range got its own thread
+    pthread_t thread;
+} RangeTask;
+
+static void* range_task_run(void* arg) {
+    RangeTask* task = (RangeTask*)arg;
+    task->function(task->context, task->begin, task->end);
+    return NULL;
+}
+
+// Run function(context, begin, end) over ranges covering [0, count), returns when all are done
+// Every worker gets at least min_items items, for loops whose items are expensive
+void parallel_for_grain(int count, int min_items, RangeFunction function, void* context) {
+    int workers = mining_worker_count();
+    if (workers > count / min_items) workers = count / min_items;
+    if (workers <= 1) {
+        if (count > 0) function(context, 0, count);
+        return;
+    }
+    
+    RangeTask* tasks = malloc(workers * sizeof(RangeTask));
+    if (!tasks) {
+        function(context, 0, count);
+        return;
+    }
+    for (int w = 0; w < workers; w++) {
+        tasks[w].function = function;
+        tasks[w].context = context;
+        tasks[w].begin = (int)((long)count * w / workers);
+        tasks[w].end = (int)((long)count * (w + 1) / workers);
+    }
+    
+    // Ranges whose thread could not be created run on the calling thread
+    for (int w = 1; w < workers; w++) {
+        tasks[w].started = pthread_create(&tasks[w].thread, NULL, range_task_run, &tasks[w]) == 0;
+    }
+    range_task_run(&tasks[0]);
+    for (int w = 1; w < workers; w++) {
+        if (tasks[w].started) {
+            pthread_join(tasks[w].thread, NULL);
+        } else {
+            range_task_run(&tasks[w]);
+        }
+    }
+    free(tasks);
+}
+
+// parallel_for_grain for cheap items, PARALLEL_MIN_ITEMS per worker
+void parallel_for(int count, RangeFunction function, void* context) {
+    parallel_for_grain(count, PARALLEL_MIN_ITEMS, function, context);
+}
+
+/*
+ * BLOCK STORE
+ * Confirmed blocks are published once into fixed-size segments shared by every
+ * node: a contiguous array of block headers plus an event arena per segment.
+ * Stored blocks are immutable and reference counted, each chain holding a block
+ * takes a reference. A segment is freed once it is full and none of its blocks
+ * are referenced any more.
+ */
+
+#define STORE_CHUNK_BYTES (64 * 1024) // Minimum size of an arena chunk
+
+// Free a segment and its event arena
+static void store_segment_free(StoreSegment* segment) {
+    ArenaChunk* chunk = segment->arena;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(segment);
+}
+
+// Free all memory used by the store, every block must have been released
+void block_store_free(BlockStore* store) {
+    pthread_mutex_lock(&store->lock);
+    for (int s = 0; s < store->segment_count; s++) {
+        if (store->segments[s]) store_segment_free(store->segments[s]);
+    }
+    while (store->retired) {
+        StoreSegment* next = store->retired->retired_next;
+        store_segment_free(store->retired);
+        store->retired = next;
+    }
+    free(store->segments);
+    store->segments = NULL;
+    store->segment_count = 0;
+    store->segment_capacity = 0;
+    store->live_blocks = 0;
+    pthread_mutex_unlock(&store->lock);
+}
+
+// Reserve size bytes in a segment's arena (8-byte aligned)
+static void* store_alloc(StoreSegment* segment, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaChunk* chunk = segment->arena;
+    if (!chunk || chunk->capacity - chunk->used < size) {
+        size_t capacity = size > STORE_CHUNK_BYTES ? size : STORE_CHUNK_BYTES;
+        chunk = malloc(sizeof(ArenaChunk) + capacity);
+        if (!chunk) return NULL;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        chunk->next = segment->arena;
+        segment->arena = chunk;
+    }
+    void* memory = chunk->bytes + chunk->used;
+    chunk->used += size;
+    return memory;
+}
+
+// Copy a block into a store slot, its events go to the segment's arena
+// Payloads are packed back to back, so space left by replaced payloads isn't copied
+static bool store_copy_block(StoreSegment* segment, Block* stored, const Block* block) {
+    int count = block->event_count;
+    EventColumns events;
+    memset(&events, 0, sizeof(events));
+    
+    if (count > 0) {
+        size_t data_size = 0;
+        for (int i = 0; i < count; i++) data_size += block->events.data_length[i] + 1;
+        
+        void* columns = store_alloc(segment, event_columns_size(count));
+        events.data = store_alloc(segment, data_size);
+        if (!columns || !events.data) return false;
+        event_columns_layout(&events, columns, count);
+        event_columns_copy(&events, &block->events, count);
+        
+        for (int i = 0; i < count; i++) {
+            uint32_t length = block->events.data_length[i];
+            memcpy(events.data + events.data_used, block->events.data + block->events.data_offset[i], length + 1);
+            events.data_offset[i] = (uint32_t)events.data_used;
+            events.data_used += length + 1;
+        }
+        events.data_capacity = events.data_used;
+    }
+    
+    stored->index = block->index;
+    stored->timestamp = block->timestamp;
+    stored->previous_hash = block->previous_hash;
+    stored->merkle_root = block->merkle_root;
+    stored->nonce = block->nonce;
+    stored->bits = block->bits;
+    stored->hash = block->hash;
+    stored->events = events;
+    stored->event_count = count;
+    stored->event_capacity = count;  // Stored blocks are complete, they don't grow
+    stored->merkle = NULL;           // Only blocks being built need the accumulator
+    stored->segment = segment;
+    atomic_init(&stored->refs, 1);
+    return true;
+}
+
+// Copy a finished block (header and events) into the shared store
+// Returns the stored copy with one reference held by the caller,
+// or NULL if memory allocation failed. The caller keeps ownership of block.
+Block* block_publish(const Block* block) {
+    BlockStore* store = &block_store;
+    pthread_mutex_lock(&store->lock);
+    
+    // Open a new segment when the last one is full
+    StoreSegment* segment = store->segment_count ? store->segments[store->segment_count - 1] : NULL;
+    if (!segment || segment->used == STORE_SEGMENT_BLOCKS) {
+        if (store->segment_count == store->segment_capacity) {
+            int capacity = store->segment_capacity ? store->segment_capacity * 2 : 4;
+            StoreSegment** segments = realloc(store->segments, capacity * sizeof(StoreSegment*));
+            if (!segments) {
+                pthread_mutex_unlock(&store->lock);
+                return NULL;
+            }
+            store->segments = segments;
+            store->segment_capacity = capacity;
+        }
+        segment = malloc(sizeof(StoreSegment));
+        if (!segment) {
+            pthread_mutex_unlock(&store->lock);
+            return NULL;
+        }
+        segment->arena = NULL;
+        segment->used = 0;
+        segment->live = 0;
+        segment->position = store->segment_count;
+        segment->retired_next = NULL;
+        store->segments[store->segment_count++] = segment;
+    }
+    
+    Block* stored = &segment->blocks[segment->used];
+    if (!store_copy_block(segment, stored, block)) {
+        pthread_mutex_unlock(&store->lock);
+        return NULL;
+    }
+    segment->used++;
+    segment->live++;
+    store->live_blocks++;
+    store->total_blocks++;
+    
+    pthread_mutex_unlock(&store->lock);
+    return stored;
+}
+
+// Take one more reference on a stored block
+Block* block_retain(Block* block) {
+    atomic_fetch_add_explicit(&block->refs, 1, memory_order_relaxed);
+    return block;
+}
+
+// Drop a reference on a stored block
+// The last reference marks the block dead, its segment goes once every slot is dead
+void block_release(Block* block) {
+    if (!block) return;
+    if (atomic_fetch_sub_explicit(&block->refs, 1, memory_order_acq_rel) != 1) return;
+    
+    BlockStore* store = &block_store;
+    pthread_mutex_lock(&store->lock);
+    StoreSegment* segment = block->segment;
+    segment->live--;
+    store->live_blocks--;
+    if (segment->live == 0 && segment->used == STORE_SEGMENT_BLOCKS) {
+        store->segments[segment->position] = NULL;
+        // A tip reader may still be looking at a block of this segment, wait for it to leave
+        segment->retired_next = store->retired;
+        store->retired = segment;
+    }
+    if (store->retired && atomic_load(&store->tip_readers) == 0) {
+        while (store->retired) {
+            StoreSegment* next = store->retired->retired_next;
+            store_segment_free(store->retired);
+            store->retired = next;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+}
+
+/*
+ * CONSENSUS TRACKER
+ * Which active nodes hold each block on their main chain. Chains report
+ * blocks as they enter and leave their main chain (see CHAIN INDEX), so
+ * asking whether a block has consensus is one lookup instead of a scan of
+ * every node's chain, and the tracker sees the moment a block gets there.
+ */
+
+#define TRACKER_INITIAL_CAPACITY 256  // Hash table slots at the first block (power of two)
+
+// Table slot for a block hash, keyed like the chain index (see digest_key)
+static size_t tracker_slot(const Digest* hash, size_t capacity) {
+    return (size_t)digest_key(hash) & (capacity - 1);
+}
+
+// Entry of a block hash, NULL if no counted chain holds it. The caller holds consensus.lock
+static ConsensusEntry* tracker_find(const Digest* hash) {
+    if (consensus.capacity == 0) return NULL;
+    size_t slot = tracker_slot(hash, consensus.capacity);
+    while (consensus.slots[slot].holders) {
+        if (digest_equal(&consensus.slots[slot].hash, hash)) return &consensus.slots[slot];
+        slot = (slot + 1) & (consensus.capacity - 1);
+    }
+    return NULL;
+}
+
+// Entry of a block hash, a new one if it isn't there. NULL if memory allocation failed
+// The caller holds consensus.lock
+static ConsensusEntry* tracker_insert(const Digest* hash, int height) {
+    ConsensusEntry* found = tracker_find(hash);
+    if (found) return found;
+    
+    // Grow at 70% full like the chain index
+    if ((consensus.count + 1) * 10 > consensus.capacity * 7) {
+        size_t capacity = consensus.capacity ? consensus.capacity * 2 : TRACKER_INITIAL_CAPACITY;
+        ConsensusEntry* table = calloc(capacity, sizeof(ConsensusEntry));
+        if (!table) return NULL;
+        for (size_t i = 0; i < consensus.capacity; i++) {
+            if (!consensus.slots[i].holders) continue;
+            size_t slot = tracker_slot(&consensus.slots[i].hash, capacity);
+            while (table[slot].holders) slot = (slot + 1) & (capacity - 1);
+            table[slot] = consensus.slots[i];
+        }
+        free(consensus.slots);
+        consensus.slots = table;
+        consensus.capacity = capacity;
+    }
+    
+    uint64_t* holders = calloc(1, sizeof(uint64_t));
+    if (!holders) return NULL;
+    size_t slot = tracker_slot(hash, consensus.capacity);
+    while (consensus.slots[slot].holders) slot = (slot + 1) & (consensus.capacity - 1);
+    consensus.slots[slot] = (ConsensusEntry){ .hash = *hash, .holders = holders, .words = 1, .height = height };
+    consensus.count++;
+    return &consensus.slots[slot];
+}
+
+// Drop an entry nobody holds anymore, later entries of its probe run are shifted back
+// The caller holds consensus.lock
+static void tracker_remove(ConsensusEntry* entry) {
+    size_t mask = consensus.capacity - 1;
+    size_t slot = entry - consensus.slots;
+    free(entry->holders);
+    consensus.slots[slot].holders = NULL;
+    consensus.count--;
+    
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (!consensus.slots[next].holders) break;
+        size_t home = tracker_slot(&consensus.slots[next].hash, consensus.capacity);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            consensus.slots[slot] = consensus.slots[next];
+            consensus.slots[next].holders = NULL;
+            slot = next;
+        }
+    }
+}
+
+// Whether enough counted chains hold an entry, the caller holds consensus.lock
+static bool tracker_has_consensus(const ConsensusEntry* entry) {
+    return consensus.members > 0 &&
+           (double)entry->count / consensus.members >= chain_params.consensus_threshold;
+}
+
+// Queue a block that just reached the threshold for the listener, the caller holds consensus.lock
+// The listener isn't called here: the caller also holds a chain lock (see consensus_deliver_finalized)
+static void tracker_queue_finalized(const ConsensusEntry* entry) {
+    if (!consensus.on_finalized) return;  // Nobody would drain the queue
+    if (consensus.pending_count == consensus.pending_capacity) {
+        int capacity = consensus.pending_capacity ? consensus.pending_capacity * 2 : 16;
+        FinalizedBlock* pending = realloc(consensus.pending, capacity * sizeof(FinalizedBlock));
+        if (!pending) return;  // Out of memory: still counted, but the listener won't hear of it
+        consensus.pending = pending;
+        consensus.pending_capacity = capacity;
+    }
+    consensus.pending[consensus.pending_count++] = (FinalizedBlock){
+        .hash = entry->hash, .height = entry->height, .holders = entry->count, .members = consensus.members
+    };
+}
+
+// Count a main chain block for a node, the caller holds its chain->lock
+static void tracker_add_block(int node_id, const Block* block) {
+    pthread_mutex_lock(&consensus.lock);
+    ConsensusEntry* entry = tracker_insert(&block->hash, block->index);
+    int word = node_id / 64;
+    if (entry && word >= entry->words) {
+        uint64_t* holders = realloc(entry->holders, (word + 1) * sizeof(uint64_t));
+        if (holders) {
+            memset(holders + entry->words, 0, (word + 1 - entry->words) * sizeof(uint64_t));
+            entry->holders = holders;
+            entry->words = word + 1;
+        }
+    }
+    uint64_t bit = 1ULL << (node_id % 64);
+    if (entry && word < entry->words && !(entry->holders[word] & bit)) {
+        entry->holders[word] |= bit;
+        entry->count++;
+        
+        // Checked as holders join: count and queue the block the first time it gets there
+        if (!entry->finalized && tracker_has_consensus(entry)) {
+            entry->finalized = true;
+            consensus.finalized++;
+            if (entry->height > consensus.finalized_height) consensus.finalized_height = entry->height;
+            tracker_queue_finalized(entry);
+        }
+    }
+    pthread_mutex_unlock(&consensus.lock);
+}
+
+// Stop counting a block for a node, the caller holds its chain->lock
+static void tracker_remove_block(int node_id, const Digest* hash) {
+    pthread_mutex_lock(&consensus.lock);
+    ConsensusEntry* entry = tracker_find(hash);
+    int word = node_id / 64;
+    uint64_t bit = 1ULL << (node_id % 64);
+    if (entry && word < entry->words && (entry->holders[word] & bit)) {
+        entry->holders[word] &= ~bit;
+        if (--entry->count == 0) tracker_remove(entry);
+    }
+    pthread_mutex_unlock(&consensus.lock);
+}
+
+// Start counting a chain as node_id, with every block already on its main chain
+// The caller holds chain->lock exclusively
+void consensus_track_chain(Blockchain* chain, int node_id) {
+    if (chain->consensus_id >= 0) return;
+    chain->consensus_id = node_id;
+    pthread_mutex_lock(&consensus.lock);
+    consensus.members++;
+    pthread_mutex_unlock(&consensus.lock);
+    for (int h = 0; h < chain->block_count; h++) tracker_add_block(node_id, chain->by_height[h]);
+}
+
+// Stop counting a chain (its node goes offline or away), the caller holds chain->lock exclusively
+void consensus_untrack_chain(Blockchain* chain) {
+    int node_id = chain->consensus_id;
+    if (node_id < 0) return;
+    for (int h = 0; h < chain->block_count; h++) tracker_remove_block(node_id, &chain->by_height[h]->hash);
+    chain->consensus_id = -1;
+    pthread_mutex_lock(&consensus.lock);
+    consensus.members--;
+    pthread_mutex_unlock(&consensus.lock);
+}
+
+// Whether the consensus threshold of active nodes holds a block on their main chain, O(1)
+bool consensus_reached(const Digest* hash) {
+    pthread_mutex_lock(&consensus.lock);
+    ConsensusEntry* entry = tracker_find(hash);
+    bool reached = entry && tracker_has_consensus(entry);
+    pthread_mutex_unlock(&consensus.lock);
+    return reached;
+}
+
+// Tell the listener about the blocks finalized since the last call, oldest first
+// Node threads call it after releasing their chain lock, so must any other caller: the
+// listener runs without the tracker or a chain locked and may query them
+void consensus_deliver_finalized(void) {
+    pthread_mutex_lock(&consensus.delivery_lock);
+    pthread_mutex_lock(&consensus.lock);
+    FinalizedBlock* pending = consensus.pending;
+    int count = consensus.pending_count;
+    consensus.pending = NULL;
+    consensus.pending_count = consensus.pending_capacity = 0;
+    pthread_mutex_unlock(&consensus.lock);
+    
+    for (int i = 0; i < count; i++) consensus.on_finalized(&pending[i]);
+    pthread_mutex_unlock(&consensus.delivery_lock);
+    free(pending);
+}
+
+// Free the table, once every chain has been freed
+void consensus_tracker_free(void) {
+    for (size_t i = 0; i < consensus.capacity; i++) free(consensus.slots[i].holders);
+    free(consensus.slots);
+    free(consensus.pending);
+    consensus.pending = NULL;
+    consensus.pending_count = consensus.pending_capacity = 0;
+    consensus.slots = NULL;
+    consensus.capacity = consensus.count = 0;
+}
+
+/*
+ * CHAIN INDEX
+ * Hash table (block hash -> Block*) and height array for every chain,
+ * so lookups don't have to scan the chain from genesis
+ */
+
+#define INDEX_INITIAL_CAPACITY 64   // Hash table slots for a new chain (power of two)
+
+// Table slot for a block hash (see digest_key)
+static size_t index_slot(const Digest* digest, size_t capacity) {
+    return (size_t)digest_key(digest) & (capacity - 1);
+}
+
+// Insert into the hash table without growing it (open addressing, linear probing)
+static void index_insert_slot(BlockIndexEntry* table, size_t capacity, const BlockIndexEntry* entry) {
+    size_t slot = index_slot(&entry->hash, capacity);
+    while (table[slot].block) {
+        if (digest_equal(&table[slot].hash, &entry->hash)) {
+            table[slot] = *entry;  // Same hash: keep the newest copy
+            return;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+    table[slot] = *entry;
+}
+
+// Remove a hash from the table, later entries of its probe run are shifted back
+// Returns false if the hash was not in the table
+static bool index_remove_slot(BlockIndexEntry* table, size_t capacity, const Digest* hash) {
+    size_t mask = capacity - 1;
+    size_t slot = index_slot(hash, capacity);
+    while (table[slot].block && !digest_equal(&table[slot].hash, hash)) slot = (slot + 1) & mask;
+    if (!table[slot].block) return false;
+    
+    table[slot].block = NULL;
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (!table[next].block) break;
+        // Move the entry back if its home slot doesn't lie in (slot, next]
+        size_t home = index_slot(&table[next].hash, capacity);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            table[slot] = table[next];
+            table[next].block = NULL;
+            slot = next;
+        }
+    }
+    return true;
+}
+
+// Returns false if memory allocation failed
+bool block_index_init(BlockIndex* index) {
+    index->capacity = INDEX_INITIAL_CAPACITY;
+    index->count = 0;
+    index->slots = calloc(index->capacity, sizeof(BlockIndexEntry));
+    return index->slots != NULL;
+}
+
+void block_index_clear(BlockIndex* index) {
+    memset(index->slots, 0, index->capacity * sizeof(BlockIndexEntry));
+    index->count = 0;
+}
+
+void block_index_free(BlockIndex* index) {
+    free(index->slots);
+}
+
+// Entry of a block by its hash, NULL if the index doesn't have it
+BlockIndexEntry* block_index_find(const BlockIndex* index, const Digest* hash) {
+    size_t slot = index_slot(hash, index->capacity);
+    while (index->slots[slot].block) {
+        if (digest_equal(&index->slots[slot].hash, hash)) return &index->slots[slot];
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    return NULL;
+}
+
+// Add or update a block, it does not take a reference
+// Returns false if the table had to grow and memory allocation failed, the index is unchanged then
+bool block_index_put(BlockIndex* index, Block* block, ChainWork work) {
+    // Grow the hash table when it is 70% full, so probe sequences stay short
+    if ((index->count + 1) * 10 > index->capacity * 7) {
+        size_t capacity = index->capacity * 2;
+        BlockIndexEntry* table = calloc(capacity, sizeof(BlockIndexEntry));
+        if (!table) return false;
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->slots[i].block) index_insert_slot(table, capacity, &index->slots[i]);
+        }
+        free(index->slots);
+        index->slots = table;
+        index->capacity = capacity;
+    }
+    BlockIndexEntry entry = { block->hash, block, work };
+    if (!block_index_find(index, &block->hash)) index->count++;
+    index_insert_slot(index->slots, index->capacity, &entry);
+    return true;
+}
+
+bool block_index_remove(BlockIndex* index, const Digest* hash) {
+    if (!index_remove_slot(index->slots, index->capacity, hash)) return false;
+    index->count--;
+    return true;
+}
+
+// Set up empty indexes for a new chain
+// Returns false if memory allocation failed, chain_index_free cleans up what was allocated
+bool chain_index_init(Blockchain* chain) {
+    bool index_ok = block_index_init(&chain->index);
+    bool side_ok = block_index_init(&chain->side);
+    chain->orphan_count = 0;
+    chain->reorgs = 0;
+    chain->deepest_reorg = 0;
+    chain->height_capacity = INDEX_INITIAL_CAPACITY;
+    chain->by_height = calloc(chain->height_capacity, sizeof(Block*));
+    return index_ok && side_ok && chain->by_height;
+}
+
+// Forget every block of the main chain (the chain is about to be rebuilt)
+void chain_index_clear(Blockchain* chain) {
+    block_index_clear(&chain->index);
+    memset(chain->by_height, 0, chain->height_capacity * sizeof(Block*));
+}
+
+// Free the index memory
+void chain_index_free(Blockchain* chain) {
+    block_index_free(&chain->index);
+    block_index_free(&chain->side);
+    free(chain->by_height);
+}
+
+// Register a main chain block in both indexes, the caller must hold chain->lock
+// Returns false if memory allocation failed, the block is in neither index then
+bool chain_index_add(Blockchain* chain, Block* block, ChainWork work) {
+    // Height array grows by doubling like the events array
+    if (block->index >= chain->height_capacity) {
+        int capacity = chain->height_capacity;
+        while (block->index >= capacity) capacity *= 2;
+        Block** heights = realloc(chain->by_height, capacity * sizeof(Block*));
+        if (!heights) return false;
+        memset(heights + chain->height_capacity, 0, (capacity - chain->height_capacity) * sizeof(Block*));
+        chain->by_height = heights;
+        chain->height_capacity = capacity;
+    }
+    if (!block_index_put(&chain->index, block, work)) return false;
+    if (chain->consensus_id >= 0) tracker_add_block(chain->consensus_id, block);
+    chain->by_height[block->index] = block;
+    return true;
+}
+
+// Take a block off the main chain's hash index, the caller must hold chain->lock
+static void chain_index_remove(Blockchain* chain, const Digest* hash) {
+    block_index_remove(&chain->index, hash);
+    if (chain->consensus_id >= 0) tracker_remove_block(chain->consensus_id, hash);
+}
+
+// Find a block of the main chain by its hash, NULL if the chain doesn't have it
+Block* chain_find_block(Blockchain* chain, const Digest* hash) {
+    BlockIndexEntry* entry = block_index_find(&chain->index, hash);
+    return entry ? entry->block : NULL;
+}
+
+// Cumulative work of the main chain, the caller must hold chain->lock
+ChainWork chain_tip_work(Blockchain* chain) {
+    if (!chain->last_block) return 0;
+    return block_index_find(&chain->index, &chain->last_block->hash)->work;
+}
+
+// Block at a given height of the chain, NULL if the chain is shorter
+Block* chain_block_at(Blockchain* chain, int height) {
+    if (height < 0 || height >= chain->block_count) return NULL;
+    return chain->by_height[height];
+}
+
+// Make last_block visible to lock-free tip readers, call after every change of last_block
+// The new tip is published before the old one can be released, see CHAIN TIP
+static void chain_publish_tip(Blockchain* chain) {
+    atomic_store(&chain->tip, chain->last_block);
+}
+
+// Put a stored block on top of the chain tip and index it, the caller must hold chain->lock
+// The chain takes its own reference, so the caller keeps its one
+// Returns NULL if memory allocation failed, the chain is unchanged then
+Block* append_block(Blockchain* chain, Block* block) {
+    ChainWork work = chain_tip_work(chain) + block_work(block->bits);
+    if (!chain_index_add(chain, block, work)) return NULL;
+    block_retain(block);
+    chain->last_block = block;
+    chain->block_count++;
+    chain_publish_tip(chain);
+    return block;
+}
+
+// Swap the stored block at old->index for another version, the caller must hold chain->lock
+// The chain takes over the caller's reference on block and drops its reference on old
+void chain_replace_block(Blockchain* chain, Block* old, Block* block) {
+    if (chain->checkpoint_height >= old->index) chain->checkpoint_height = old->index - 1;
+    chain->rewrites++;
+    if (atomic_load(&chain->log_dirty_from) > old->index) atomic_store(&chain->log_dirty_from, old->index);
+    ChainWork work = block_index_find(&chain->index, &old->hash)->work;  // Same bits, same work
+    chain_index_remove(chain, &old->hash);
+    chain_index_add(chain, block, work);  // Can't fail, it takes the slot and height old just left
+    if (chain->last_block == old) {
+        chain->last_block = block;
+        chain_publish_tip(chain);
+    }
+    block_release(old);
+}
+
+// Drop the blocks above a height, the block at height becomes the tip again
+// The caller must hold chain->lock
+void chain_truncate(Blockchain* chain, int height) {
+    if (height < chain->block_count - 1) {
+        // Tip moves down first, so readers no longer reach the blocks released below
+        chain->last_block = chain->by_height[height];
+        chain_publish_tip(chain);
+        if (chain->checkpoint_height > height) chain->checkpoint_height = height;
+        chain->rewrites++;
+        if (atomic_load(&chain->log_dirty_from) > height + 1) atomic_store(&chain->log_dirty_from, height + 1);
+    }
+    for (int h = chain->block_count - 1; h > height; h--) {
+        Block* block = chain->by_height[h];
+        chain_index_remove(chain, &block->hash);
+        chain->by_height[h] = NULL;
+        block_release(block);
+    }
+    chain->block_count = height + 1;
+}
+
+// Drop the side branches and orphans of a chain, the caller must hold chain->lock
+static void chain_release_side(Blockchain* chain) {
+    for (size_t i = 0; i < chain->side.capacity; i++) {
+        if (chain->side.slots[i].block) block_release(chain->side.slots[i].block);
+    }
+    block_index_clear(&chain->side);
+    for (int i = 0; i < chain->orphan_count; i++) block_release(chain->orphans[i]);
+    chain->orphan_count = 0;
+}
+
+// Drop every block of the chain (it is about to be rebuilt or freed), the caller must hold chain->lock
+void chain_release_blocks(Blockchain* chain) {
+    chain->checkpoint_height = -1;
+    chain->rewrites++;
+    atomic_store(&chain->log_dirty_from, 0);
+    chain->last_block = NULL;
+    chain_publish_tip(chain);
+    for (int h = 0; h < chain->block_count; h++) {
+        if (chain->consensus_id >= 0) tracker_remove_block(chain->consensus_id, &chain->by_height[h]->hash);
+        block_release(chain->by_height[h]);
+    }
+    chain_index_clear(chain);
+    chain_release_side(chain);
+    chain->block_count = 0;
+}
+
+// Compact target the next block on top of the chain needs, the caller must hold chain->lock
+uint32_t chain_next_bits(Blockchain* chain) {
+    return next_block_bits(chain->by_height, chain->block_count);
+}
+
+// Start a new mining block on the chain tip, with the target it needs
+// The caller must hold chain->lock exclusively
+// Returns false if memory allocation failed, the chain has no mining block until the next reset
+bool chain_reset_mining_block(Blockchain* chain) {
+    pool_free_block(&chain->pool, chain->current_mining_block);
+    chain->current_mining_block = pool_create_block(&chain->pool, chain->block_count, &chain->last_block->hash);
+    if (!chain->current_mining_block) return false;
+    chain->current_mining_block->bits = chain_next_bits(chain);
+    return true;
+}
+
+/*
+ * CHAIN TIP
+ * The tip of every chain is published in an atomic pointer, so it can be read
+ * without chain->lock. A reader announces itself in block_store.tip_readers
+ * before loading the pointer: writers publish a new tip before releasing the old
+ * block, and block_release keeps dead segments on a retired list while any reader
+ * is announced, so the block a reader loaded stays readable until it leaves.
+ */
+
+// Take a reference on a stored block unless its last reference is already gone
+static bool block_try_retain(Block* block) {
+    int refs = atomic_load_explicit(&block->refs, memory_order_relaxed);
+    while (refs > 0) {
+        if (atomic_compare_exchange_weak_explicit(&block->refs, &refs, refs + 1,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Tip block of a chain, retained for the caller (who must block_release it)
+// Never blocks, returns NULL only while the chain is being rebuilt from scratch
+Block* chain_tip_acquire(Blockchain* chain) {
+    atomic_fetch_add(&block_store.tip_readers, 1);
+    Block* tip;
+    do {
+        // A tip whose last reference went is being replaced, load the new one
+        tip = atomic_load(&chain->tip);
+    } while (tip && !block_try_retain(tip));
+    atomic_fetch_sub(&block_store.tip_readers, 1);
+    return tip;
+}
+
+// Height and hash of the chain tip, without locking or taking a reference
+ChainTip get_chain_tip(Blockchain* chain) {
+    ChainTip snapshot = { .height = -1 };
+    atomic_fetch_add(&block_store.tip_readers, 1);
+    Block* tip = atomic_load(&chain->tip);
+    if (tip) {
+        snapshot.height = tip->index;
+        snapshot.hash = tip->hash;
+    }
+    atomic_fetch_sub(&block_store.tip_readers, 1);
+    return snapshot;
+}
+
+/*
+ * NODE WAKEUPS
+ * Node threads sleep on a condition variable until something concerns them:
+ * an inbound block, a new transaction, a tip change or shutdown
+ */
+
+// Absolute CLOCK_REALTIME time timeout_ms from now, for node_wait
+struct timespec deadline_after_ms(int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+// Set up the wakeup state of a node
+void node_events_init(Node* node) {
+    atomic_init(&node->events, 0);
+    atomic_init(&node->waiting, false);
+    atomic_init(&node->mining_cancel, false);
+    atomic_init(&node->cancelled_jobs, 0);
+    atomic_init(&node->cancelled_hashes, 0);
+    atomic_init(&node->stale_blocks, 0);
+    pthread_mutex_init(&node->wait_lock, NULL);
+    pthread_cond_init(&node->wakeup, NULL);
+}
+
+// Tell a node's thread something happened (NODE_EVENT_* bits), never blocks for long
+// The mutex is only taken when the node is asleep, a busy node sees the bits on its next wait
+void node_notify(Node* node, unsigned events) {
+    atomic_fetch_or(&node->events, events);
+    // Pairs with the fence in node_wait: either we see waiting or the node sees the bits
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&node->waiting, memory_order_relaxed)) {
+        pthread_mutex_lock(&node->wait_lock);
+        pthread_cond_signal(&node->wakeup);
+        pthread_mutex_unlock(&node->wait_lock);
+    }
+}
+
+// Sleep until node_notify or the deadline (NULL = no deadline), only the node's thread may call this
+// Returns the NODE_EVENT_* bits received, 0 means the deadline passed
+unsigned node_wait(Node* node, const struct timespec* deadline) {
+    pthread_mutex_lock(&node->wait_lock);
+    atomic_store(&node->waiting, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&node->events) == 0) {
+        if (deadline) {
+            pthread_cond_timedwait(&node->wakeup, &node->wait_lock, deadline);
+        } else {
+            pthread_cond_wait(&node->wakeup, &node->wait_lock);
+        }
+    }
+    atomic_store(&node->waiting, false);
+    pthread_mutex_unlock(&node->wait_lock);
+    return atomic_exchange(&node->events, 0);
+}
+
+// Wake the node that owns a chain, if any
+void notify_chain_owner(Blockchain* chain, unsigned events) {
+    if (chain->owner) node_notify(chain->owner, events);
+}
+
+/*
+ * VALIDATION FUNCTIONS
+ * Ensure data integrity throughout the blockchain
+ */
+
+// Validate an individual event/transaction
+bool validate_event(const Event* event) {
+    //  this is supposed to check signatures, account balances... in real BC 
+    // For this simulation, we just validate events of type 1 (transactions)
+    if (event->type == 1) {
+        // here assuming all transactions are valid ( is valid bool is set to true for all of them just for simulation )
+        return true;
+    }
+    
+    // Other event types don't need special validation
+    return true;
+}
+
+// Bytes a varint takes on the wire (see buffer_put_varint)
+static size_t varint_size(uint64_t value) {
+    size_t length = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+static size_t zigzag_size(int64_t value) {
+    return varint_size(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+// Bytes event i takes in the block's encoding (see encode_block)
+static size_t encoded_event_size(int type, int64_t timestamp, size_t length, int64_t block_timestamp) {
+    return zigzag_size(type) + zigzag_size(timestamp - block_timestamp) + varint_size(length) + length;
+}
+
+// Bytes encode_block writes for a block, without encoding it
+size_t encoded_block_size(const Block* block) {
+    size_t size = 1 + varint_size((uint32_t)block->index) + zigzag_size((int64_t)block->timestamp) +
+                  2 * DIGEST_SIZE + 4 + 4 + varint_size((uint32_t)block->event_count);
+    const EventColumns* events = &block->events;
+    for (int i = 0; i < block->event_count; i++) {
+        size += encoded_event_size(events->type[i], events->timestamp[i], events->data_length[i],
+                                   (int64_t)block->timestamp);
+    }
+    return size;
+}
+
+// Validate all events in a block
+// A block too large for a frame of its own is invalid too: peers could never sync it
+bool validate_block_events(Block* block) {
+    if (encoded_block_size(block) > WIRE_MAX_BLOCK) return false;
+    for (int i = 0; i < block->event_count; i++) {
+        Event event = get_event(block, i);
+        if (!validate_event(&event)) {
+            return false;  // If any event is invalid, the block is invalid
+        }
+    }
+    return true;  // All events are valid
+}
+
+// Append an event whose hash is already known to a block
+// Updates the Merkle accumulator but not the root or the block hash, so a batch
+// of events only pays for those once (see block_seal_events)
+// Returns 1 on success, 0 if block is full
+static int block_append_event(Block* block, int type, const char* data, size_t length,
+                              time_t timestamp, const Digest* hash) {
+    if (block->event_count >= chain_params.max_events) return 0;  // Block is full
+    
+    // Expand capacity if needed (dynamic resizing)
+    if (block->event_count >= block->event_capacity) {
+        int capacity = block->event_capacity ? block->event_capacity * 2 : 10;  // Double the capacity
+        
+        // But we don't exceed the maximum events per block
+        if (capacity > chain_params.max_events) 
+            capacity = chain_params.max_events;
+            
+        // Reallocate the event columns
+        if (!block_reserve_events(block, capacity)) return 0;  // Memory allocation failed
+    }
+    
+    // Payloads have no fixed size limit, they are copied into the block's payload arena
+    if (length >= UINT32_MAX || !block_reserve_data(block, length + 1)) return 0;
+    
+    // Add the new event to the block 
+    EventColumns* events = &block->events;
+    int i = block->event_count++;
+    events->type[i] = type;
+    events->timestamp[i] = (int64_t)timestamp;  // Formatted only for display
+    events->data_offset[i] = (uint32_t)events->data_used;
+    events->data_length[i] = (uint32_t)length;
+    memcpy(events->data + events->data_used, data, length);
+    events->data[events->data_used + length] = '\0';  // data may be a slice of a larger buffer
+    events->data_used += length + 1;
+    events->hash[i] = *hash;
+    events->is_valid[i] = false;
+    
+    Event event = get_event(block, i);
+    events->is_valid[i] = validate_event(&event);
+    
+    merkle_accumulator_append(block->merkle, &events->hash[i]);  // O(log n)
+    return 1;  // Success
+}
+
+// Update the Merkle root and block hash after block_append_event calls
+static void block_seal_events(Block* block) {
+    update_merkle_root(block);
+    hash_block(block);
+}
+
+// Add an event with a given creation time to a block
+// Returns 1 on success, 0 if block is full
+int add_event_at(Block* block, int type, const char* data, time_t timestamp) {
+    size_t length = strlen(data);
+    if (length >= UINT32_MAX) return 0;
+    
+    // Calculate hash and validate
+    Digest hash;
+    hash_event_fields(type, (int64_t)timestamp, data, (uint32_t)length, &hash);
+    if (!block_append_event(block, type, data, length, timestamp, &hash)) return 0;
+    
+    // Update block merkle root and hash, O(log n) thanks to the accumulator
+    block_seal_events(block);
+    return 1;  // Success
+}
+
+// Add an event created now to a block
+// Returns 1 on success, 0 if block is full
+int add_event(Block* block, int type, const char* data) {
+    return add_event_at(block, type, data, time(NULL));
+}
+
+/*
+ * MEMPOOL
+ * Transactions submitted to a chain wait here until a miner builds a block.
+ * Submission only locks one shard (picked from the event hash), checks the
+ * shard's hash set for a duplicate and queues the event at the end of the
+ * shard's ring, all O(1). Miners take a batch when they start a new block.
+ */
+
+// Home slot of a hash in a shard's set
+static size_t mempool_slot(const Digest* hash) {
+    uint64_t key;
+    memcpy(&key, hash->bytes + 8, sizeof(key));  // The first bytes pick the shard
+    return (size_t)key & (MEMPOOL_SHARD_CAPACITY * 2 - 1);
+}
+
+// Slot of a hash in the set, or the empty slot where it would go
+static MempoolSlot* mempool_find(MempoolShard* shard, const Digest* hash) {
+    size_t mask = MEMPOOL_SHARD_CAPACITY * 2 - 1;
+    size_t slot = mempool_slot(hash);
+    while (shard->set[slot].entry && !digest_equal(&shard->set[slot].hash, hash)) {
+        slot = (slot + 1) & mask;
+    }
+    return &shard->set[slot];
+}
+
+// Remove a hash from the set, later entries of its probe run are shifted back
+static void mempool_unset(MempoolShard* shard, MempoolSlot* removed) {
+    size_t mask = MEMPOOL_SHARD_CAPACITY * 2 - 1;
+    size_t slot = removed - shard->set;
+    shard->set[slot].entry = NULL;
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (!shard->set[next].entry) break;
+        size_t home = mempool_slot(&shard->set[next].hash);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            shard->set[slot] = shard->set[next];
+            shard->set[next].entry = NULL;
+            slot = next;
+        }
+    }
+}
+
+static MempoolShard* mempool_shard(Mempool* pool, const Digest* hash) {
+    return &pool->shards[hash->bytes[0] % MEMPOOL_SHARDS];
+}
+
+// Set up an empty mempool
+void mempool_init(Mempool* pool) {
+    memset(pool->shards, 0, sizeof(pool->shards));
+    for (int s = 0; s < MEMPOOL_SHARDS; s++) {
+        pthread_mutex_init(&pool->shards[s].lock, NULL);
+    }
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->next_shard, 0);
+    atomic_init(&pool->duplicates, 0);
+    atomic_init(&pool->rejected, 0);
+}
+
+// Free every pending event
+void mempool_free(Mempool* pool) {
+    for (int s = 0; s < MEMPOOL_SHARDS; s++) {
+        MempoolShard* shard = &pool->shards[s];
+        for (unsigned i = shard->head; i != shard->tail; i++) {
+            free(shard->ring[i % MEMPOOL_SHARD_CAPACITY].data);
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+}
+
+// Queue an event (already hashed) in its shard unless the same event is pending
+// The caller must hold shard->lock
+// Returns 1 if queued, 0 if it was a duplicate or the shard is full
+static int mempool_insert_locked(Mempool* pool, MempoolShard* shard, const Digest* hash,
+                                 int type, const char* data, time_t timestamp) {
+    MempoolSlot* slot = mempool_find(shard, hash);
+    if (slot->entry) {
+        atomic_fetch_add(&pool->duplicates, 1);
+        return 0;
+    }
+    // Forgotten entries hold their ring slot until the head passes them
+    while (shard->head != shard->tail && !shard->ring[shard->head % MEMPOOL_SHARD_CAPACITY].data) {
+        shard->head++;
+    }
+    if (shard->tail - shard->head == MEMPOOL_SHARD_CAPACITY) {
+        atomic_fetch_add(&pool->rejected, 1);
+        return 0;
+    }
+    char* copy = strdup(data);
+    if (!copy) return 0;
+    
+    PendingEvent* entry = &shard->ring[shard->tail++ % MEMPOOL_SHARD_CAPACITY];
+    entry->hash = *hash;
+    entry->type = type;
+    entry->timestamp = timestamp;
+    entry->data = copy;
+    slot->hash = *hash;
+    slot->entry = entry;
+    atomic_fetch_add(&pool->pending, 1);
+    return 1;
+}
+
+// Queue an event (already hashed) unless the same event is pending
+// Returns 1 if queued, 0 if it was a duplicate or the shard is full
+static int mempool_add_hashed(Mempool* pool, const Digest* hash, int type, const char* data, time_t timestamp) {
+    MempoolShard* shard = mempool_shard(pool, hash);
+    pthread_mutex_lock(&shard->lock);
+    int result = mempool_insert_locked(pool, shard, hash, type, data, timestamp);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+// Submit a transaction, never waits for mining
+// Returns 1 if queued, 0 if the same event is already pending or the mempool is full
+int mempool_add(Mempool* pool, int type, const char* data, time_t timestamp) {
+    size_t length = strlen(data);
+    if (length > MAX_EVENT_DATA) return 0;
+    Digest hash;
+    hash_event_fields(type, (int64_t)timestamp, data, (uint32_t)length, &hash);
+    return mempool_add_hashed(pool, &hash, type, data, timestamp);
+}
+
+// Hash a range of a batch, see mempool_add_batch
+typedef struct {
+    const EventInput* inputs;
+    Digest* hashes;
+    time_t timestamp;
+} BatchHashJob;
+
+static void batch_hash_range(void* context, int begin, int end) {
+    BatchHashJob* job = (BatchHashJob*)context;
+    for (int i = begin; i < end; i++) {
+        const EventInput* input = &job->inputs[i];
+        size_t length = strlen(input->data);
+        hash_event_fields(input->type, (int64_t)job->timestamp, input->data,
+                          length < UINT32_MAX ? (uint32_t)length : UINT32_MAX, &job->hashes[i]);
+    }
+}
+
+// Submit many transactions at once: they share one timestamp, are hashed in parallel
+// and every shard is locked once per batch instead of once per event
+// Returns the number of events queued (duplicates and events that don't fit are skipped)
+int mempool_add_batch(Mempool* pool, const EventInput* inputs, int count, time_t timestamp) {
+    if (count <= 0) return 0;
+    Digest* hashes = malloc(count * sizeof(Digest));
+    uint8_t* shard_of = malloc(count);
+    if (!hashes || !shard_of) {
+        free(hashes);
+        free(shard_of);
+        return 0;
+    }
+    
+    BatchHashJob job = { inputs, hashes, timestamp };
+    parallel_for(count, batch_hash_range, &job);
+    
+    int queued = 0;
+    for (int i = 0; i < count; i++) shard_of[i] = (uint8_t)(hashes[i].bytes[0] % MEMPOOL_SHARDS);
+    for (int s = 0; s < MEMPOOL_SHARDS; s++) {
+        MempoolShard* shard = &pool->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (int i = 0; i < count; i++) {
+            if (shard_of[i] != s || strlen(inputs[i].data) > MAX_EVENT_DATA) continue;
+            queued += mempool_insert_locked(pool, shard, &hashes[i], inputs[i].type, inputs[i].data, timestamp);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    
+    free(shard_of);
+    free(hashes);
+    return queued;
+}
+
+// Move up to max pending events into a block being built, oldest first in every shard
+// Stops short of WIRE_MAX_BLOCK, an event that doesn't fit waits for the next block
+// Returns the number of events added
+int mempool_fill_block(Mempool* pool, Block* block, int max) {
+    if (max > chain_params.max_events - block->event_count) max = chain_params.max_events - block->event_count;
+    int added = 0;
+    size_t size = encoded_block_size(block) + 4;  // The event count may still grow by up to 4 bytes
+    unsigned first = atomic_fetch_add(&pool->next_shard, 1);
+    
+    // Round robin over the shards, one event at a time, until the block is full or nothing is left
+    bool progress = true;
+    while (added < max && progress && atomic_load(&pool->pending) > 0) {
+        progress = false;
+        for (int s = 0; s < MEMPOOL_SHARDS && added < max; s++) {
+            MempoolShard* shard = &pool->shards[(first + s) % MEMPOOL_SHARDS];
+            pthread_mutex_lock(&shard->lock);
+            // Skip the slots of forgotten events
+            while (shard->head != shard->tail && !shard->ring[shard->head % MEMPOOL_SHARD_CAPACITY].data) {
+                shard->head++;
+            }
+            if (shard->head != shard->tail) {
+                PendingEvent* entry = &shard->ring[shard->head % MEMPOOL_SHARD_CAPACITY];
+                size_t length = strlen(entry->data);
+                size_t event_size = encoded_event_size(entry->type, (int64_t)entry->timestamp, length,
+                                                       (int64_t)block->timestamp);
+                // The event keeps the hash computed on submission
+                if (size + event_size <= WIRE_MAX_BLOCK &&
+                    block_append_event(block, entry->type, entry->data, length, entry->timestamp, &entry->hash)) {
+                    size += event_size;
+                    mempool_unset(shard, mempool_find(shard, &entry->hash));
+                    free(entry->data);
+                    entry->data = NULL;
+                    shard->head++;
+                    atomic_fetch_sub(&pool->pending, 1);
+                    added++;
+                    progress = true;
+                }
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+    }
+    if (added > 0) block_seal_events(block);  // One root and block hash update for the whole batch
+    return added;
+}
+
+// Put the events of a block that won't make it into the chain back in the mempool
+void mempool_return_block(Mempool* pool, const Block* block) {
+    for (int i = 0; i < block->event_count; i++) {
+        Event event = get_event(block, i);
+        mempool_add_hashed(pool, &event.hash, event.type, event.data, event.timestamp);
+    }
+}
+
+// Drop pending events that a block (mined by someone else) already contains
+void mempool_forget_block(Mempool* pool, const Block* block) {
+    if (atomic_load(&pool->pending) == 0) return;
+    for (int i = 0; i < block->event_count; i++) {
+        const Digest* hash = &block->events.hash[i];
+        MempoolShard* shard = mempool_shard(pool, hash);
+        pthread_mutex_lock(&shard->lock);
+        MempoolSlot* slot = mempool_find(shard, hash);
+        if (slot->entry) {
+            free(slot->entry->data);
+            slot->entry->data = NULL;  // The ring slot is skipped by the next fill
+            mempool_unset(shard, slot);
+            atomic_fetch_sub(&pool->pending, 1);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/*
+ * BLOCK TREE
+ * Every chain keeps the blocks that lost a race or sit on a branch that may still
+ * win: besides the main chain (by_height and index) there are side branches
+ * (side), each block with the cumulative work of the branch ending with it. The
+ * tip is the block with the most work, ties go to the block seen first. When a
+ * side branch gets more work than the main chain, the tip moves to it in one
+ * reorg: the main blocks above the fork point become a side branch and the
+ * branch's blocks join the main chain, O(fork depth). Blocks whose parent is not
+ * known yet wait as orphans and attach when it arrives. All of it runs under the
+ * chain's write lock.
+ */
+
+#define SIDE_BRANCH_DEPTH 256       // Side blocks this far below the tip can't win anymore and are pruned
+#define SIDE_BRANCH_LIMIT 1024      // Side blocks kept before a prune pass
+
+// True if the main chain or a side branch has the block, the caller must hold chain->lock
+bool chain_knows_block(Blockchain* chain, const Digest* hash) {
+    return block_index_find(&chain->index, hash) || block_index_find(&chain->side, hash);
+}
+
+// Entry of a block on the main chain or a side branch, NULL if we don't have it
+static BlockIndexEntry* tree_find(Blockchain* chain, const Digest* hash) {
+    BlockIndexEntry* entry = block_index_find(&chain->index, hash);
+    return entry ? entry : block_index_find(&chain->side, hash);
+}
+
+// Compact target for a block on top of parent, which may be on a side branch
+// Returns 0 (which no block can meet) if the branch no longer reaches the main chain
+static uint32_t tree_bits_after(Blockchain* chain, const Block* parent) {
+    int height = parent->index + 1;
+    if (height <= 1) return chain_params.initial_bits;
+    if (!is_retarget_height(height)) return parent->bits;
+    
+    // Walk down the side branch to the main chain, below it the window start is found by height
+    int first_height = height - chain_params.retarget_interval;
+    const Block* first = parent;
+    while (first->index > first_height && !block_index_find(&chain->index, &first->hash)) {
+        BlockIndexEntry* entry = block_index_find(&chain->side, &first->previous_hash);
+        if (!entry) return 0;
+        first = entry->block;
+    }
+    if (first->index > first_height) first = chain->by_height[first_height];
+    return retarget_bits(parent, first);
+}
+
+// Drop the side blocks that fell too far below the tip
+static void tree_prune_side(Blockchain* chain) {
+    int floor = chain->block_count - SIDE_BRANCH_DEPTH;
+    Block** doomed = malloc(chain->side.count * sizeof(Block*));
+    if (!doomed) return;
+    int count = 0;
+    for (size_t i = 0; i < chain->side.capacity; i++) {
+        Block* block = chain->side.slots[i].block;
+        if (block && block->index < floor) doomed[count++] = block;
+    }
+    for (int i = 0; i < count; i++) {
+        block_index_remove(&chain->side, &doomed[i]->hash);
+        block_release(doomed[i]);
+    }
+    free(doomed);
+}
+
+// Keep a block on a side branch, the side index takes its own reference
+// Returns false if memory allocation failed
+static bool tree_add_side(Blockchain* chain, Block* block, ChainWork work) {
+    if (chain->side.count >= SIDE_BRANCH_LIMIT) tree_prune_side(chain);
+    if (!block_index_put(&chain->side, block, work)) return false;
+    block_retain(block);
+    return true;
+}
+
+// Keep a block until its parent arrives, the oldest orphan makes room when the list is full
+static void tree_add_orphan(Blockchain* chain, Block* block) {
+    for (int i = 0; i < chain->orphan_count; i++) {
+        if (digest_equal(&chain->orphans[i]->hash, &block->hash)) return;
+    }
+    if (chain->orphan_count == ORPHAN_LIMIT) {
+        block_release(chain->orphans[0]);
+        memmove(chain->orphans, chain->orphans + 1, (ORPHAN_LIMIT - 1) * sizeof(Block*));
+        chain->orphan_count--;
+    }
+    chain->orphans[chain->orphan_count++] = block_retain(block);
+}
+
+// Move the main chain onto the side branch ending with tip
+// Transactions of the blocks we leave go back to the mempool, the new blocks may hold them again
+// Returns the number of main chain blocks replaced, -1 if the branch doesn't reach the main chain
+static int tree_reorganize(Blockchain* chain, Block* tip) {
+    // Find the lowest block of the branch, its parent is the fork point
+    Block* lowest = tip;
+    while (!block_index_find(&chain->index, &lowest->previous_hash)) {
+        BlockIndexEntry* entry = block_index_find(&chain->side, &lowest->previous_hash);
+        if (!entry) return -1;
+        lowest = entry->block;
+    }
+    int fork_height = lowest->index - 1;
+    int length = tip->index - fork_height;
+    Block** branch = malloc(length * sizeof(Block*));
+    if (!branch) return -1;
+    Block* block = tip;
+    for (int i = length - 1; i >= 0; i--) {
+        branch[i] = block;
+        if (i > 0) block = block_index_find(&chain->side, &block->previous_hash)->block;
+    }
+    
+    // The main blocks above the fork point become a side branch (or are dropped if it can't grow)
+    int replaced = chain->block_count - 1 - fork_height;
+    for (int h = fork_height + 1; h < chain->block_count; h++) {
+        Block* old = chain->by_height[h];
+        // Not tree_add_side: pruning now could free blocks of the branch
+        if (block_index_put(&chain->side, old, block_index_find(&chain->index, &old->hash)->work)) block_retain(old);
+        mempool_return_block(&chain->mempool, old);
+    }
+    chain_truncate(chain, fork_height);
+    
+    // And the branch becomes the main chain, append_block recomputes the same work
+    // Out of memory the rest of the branch stays on the side, a later block or sync can take it over
+    for (int i = 0; i < length; i++) {
+        if (!append_block(chain, branch[i])) break;
+        block_index_remove(&chain->side, &branch[i]->hash);
+        mempool_forget_block(&chain->mempool, branch[i]);
+        block_release(branch[i]);  // The side index's reference, the main chain has its own
+    }
+    free(branch);
+    
+    chain->reorgs++;
+    if (replaced > chain->deepest_reorg) chain->deepest_reorg = replaced;
+    return replaced;
+}
+
+// Add a valid block (proof and events checked) to the chain's block tree
+// The caller must hold chain->lock exclusively, the tree takes its own references
+// Returns 1 if the tip moved (the block extended the main chain or its branch took over),
+// 0 if it went to a side branch or was refused, -1 if its parent is unknown (it waits as an orphan)
+int tree_attach(Blockchain* chain, Block* block) {
+    if (tree_find(chain, &block->hash)) return 0;  // Already have it
+    BlockIndexEntry* parent_entry = tree_find(chain, &block->previous_hash);
+    if (!parent_entry) {
+        tree_add_orphan(chain, block);
+        return -1;
+    }
+    
+    // Right height and the target the branch requires there
+    Block* parent = parent_entry->block;
+    ChainWork work = parent_entry->work + block_work(block->bits);  // Entries move when an index grows
+    if (block->index != parent->index + 1 || block->bits != tree_bits_after(chain, parent)) return 0;
+    
+    int result = 0;
+    if (parent == chain->last_block) {
+        if (append_block(chain, block)) {
+            mempool_forget_block(&chain->mempool, block);  // Mined by someone else
+            result = 1;
+        }
+    } else if (tree_add_side(chain, block, work)) {
+        if (work > chain_tip_work(chain) && tree_reorganize(chain, block) >= 0) result = 1;
+    }
+    
+    // Orphans waiting for this block can attach now
+    for (int i = 0; i < chain->orphan_count; i++) {
+        Block* orphan = chain->orphans[i];
+        if (!digest_equal(&orphan->previous_hash, &block->hash)) continue;
+        memmove(chain->orphans + i, chain->orphans + i + 1, (chain->orphan_count - i - 1) * sizeof(Block*));
+        chain->orphan_count--;
+        if (tree_attach(chain, orphan) > 0) result = 1;
+        block_release(orphan);
+        i = -1;  // The attach may have changed the list, start over
+    }
+    return result;
+}
+
+/*
+ * WIRE FORMAT
+ * Messages between processes are length-prefixed frames:
+ *   length (4) | type (1) | payload (length - 1 bytes)
+ * Fixed-width integers are little endian, hashes are 32 raw bytes. Blocks and
+ * events use LEB128 varints ("v"), signed values zigzag encoded ("z"). A block is
+ *   version (1) | index (v) | timestamp (z) | previous_hash (32) | merkle_root (32)
+ *   | bits (4) | nonce (4) | event_count (v)
+ * followed by each event as type (z) | timestamp - block timestamp (z) | data_length (v) | data.
+ * Block and event hashes are not sent: the receiver recomputes them, so a block
+ * whose events don't match its Merkle root or whose hash misses the target is refused.
+ */
+
+// Make room for length more bytes
+// Returns false if memory allocation failed
+static bool buffer_reserve(ByteBuffer* buffer, size_t length) {
+    if (buffer->length + length <= buffer->capacity) return true;
+    
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->length + length) capacity *= 2;
+    uint8_t* bytes = realloc(buffer->bytes, capacity);
+    if (!bytes) return false;
+    
+    buffer->bytes = bytes;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool buffer_put(ByteBuffer* buffer, const void* data, size_t length) {
+    if (!buffer_reserve(buffer, length)) return false;
+    memcpy(buffer->bytes + buffer->length, data, length);
+    buffer->length += length;
+    return true;
+}
+
+static bool buffer_put_u32(ByteBuffer* buffer, uint32_t value) {
+    uint8_t bytes[4];
+    put_le32(bytes, value);
+    return buffer_put(buffer, bytes, sizeof(bytes));
+}
+
+// 7 bits per byte, low bits first, the high bit marks that more bytes follow
+static bool buffer_put_varint(ByteBuffer* buffer, uint64_t value) {
+    uint8_t bytes[10];
+    size_t length = 0;
+    while (value >= 0x80) {
+        bytes[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = (uint8_t)value;
+    return buffer_put(buffer, bytes, length);
+}
+
+// Signed values as varints, small negative numbers stay short
+static bool buffer_put_zigzag(ByteBuffer* buffer, int64_t value) {
+    return buffer_put_varint(buffer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void buffer_free(ByteBuffer* buffer) {
+    free(buffer->bytes);
+    buffer->bytes = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+// Read fixed-width fields of a message, a read past the end returns 0 and sets failed
+static uint32_t wire_u32(WireReader* reader) {
+    if (reader->failed || reader->left < 4) {
+        reader->failed = true;
+        return 0;
+    }
+    uint32_t value = get_le32(reader->position);
+    reader->position += 4;
+    reader->left -= 4;
+    return value;
+}
+
+// A varint longer than 10 bytes or running past the end sets failed
+static uint64_t wire_varint(WireReader* reader) {
+    uint64_t value = 0;
+    for (int shift = 0; !reader->failed && shift < 64; shift += 7) {
+        if (reader->left == 0) break;
+        uint8_t byte = *reader->position++;
+        reader->left--;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    reader->failed = true;
+    return 0;
+}
+
+static int64_t wire_zigzag(WireReader* reader) {
+    uint64_t value = wire_varint(reader);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Take the next length bytes of a message, NULL (and failed) if it is shorter
+static const uint8_t* wire_bytes(WireReader* reader, size_t length) {
+    if (reader->failed || reader->left < length) {
+        reader->failed = true;
+        return NULL;
+    }
+    const uint8_t* bytes = reader->position;
+    reader->position += length;
+    reader->left -= length;
+    return bytes;
+}
+
+// Start a message of the given type in buffer, frame_end fills in its length
+static bool frame_begin(ByteBuffer* frame, uint8_t type) {
+    uint8_t header[5] = { 0, 0, 0, 0, type };
+    frame->length = 0;
+    return buffer_put(frame, header, sizeof(header));
+}
+
+static void frame_end(ByteBuffer* frame) {
+    put_le32(frame->bytes, (uint32_t)(frame->length - 4));
+}
+
+// Append the wire encoding of a block
+// Returns false if memory allocation failed
+bool encode_block(ByteBuffer* buffer, const Block* block) {
+    uint8_t version = BLOCK_FORMAT_VERSION;
+    bool ok = buffer_put(buffer, &version, 1) &&
+              buffer_put_varint(buffer, (uint32_t)block->index) &&
+              buffer_put_zigzag(buffer, (int64_t)block->timestamp) &&
+              buffer_put(buffer, block->previous_hash.bytes, DIGEST_SIZE) &&
+              buffer_put(buffer, block->merkle_root.bytes, DIGEST_SIZE) &&
+              buffer_put_u32(buffer, block->bits) &&
+              buffer_put_u32(buffer, (uint32_t)block->nonce) &&
+              buffer_put_varint(buffer, (uint32_t)block->event_count);
+    
+    // Events are created shortly before their block, so the time delta is mostly one byte
+    const EventColumns* events = &block->events;
+    for (int i = 0; ok && i < block->event_count; i++) {
+        ok = buffer_put_zigzag(buffer, events->type[i]) &&
+             buffer_put_zigzag(buffer, events->timestamp[i] - (int64_t)block->timestamp) &&
+             buffer_put_varint(buffer, events->data_length[i]) &&
+             buffer_put(buffer, events->data + events->data_offset[i], events->data_length[i]);
+    }
+    return ok;
+}
+
+// Bytes the in-memory form of a block takes: header, event columns and payload arena
+size_t block_memory_size(const Block* block) {
+    return sizeof(Block) + event_columns_size(block->event_count) + block->events.data_used;
+}
+
+// Parse the block encoding at the reader without copying it
+// Checks the header and that every event fits, then moves the reader past the block
+// and leaves view ready for block_view_next_event
+// Returns false if the encoding is malformed (the reader is then failed)
+bool block_view_open(WireReader* reader, BlockView* view) {
+    const uint8_t* start = reader->position;
+    const uint8_t* version = wire_bytes(reader, 1);
+    if (!version || *version != BLOCK_FORMAT_VERSION) {
+        reader->failed = true;
+        return false;
+    }
+    uint64_t index = wire_varint(reader);
+    view->timestamp = wire_zigzag(reader);
+    view->previous_hash = wire_bytes(reader, DIGEST_SIZE);
+    view->merkle_root = wire_bytes(reader, DIGEST_SIZE);
+    view->bits = wire_u32(reader);
+    view->nonce = wire_u32(reader);
+    uint64_t event_count = wire_varint(reader);
+    if (reader->failed || index > INT_MAX || event_count > (uint64_t)chain_params.max_events) {
+        reader->failed = true;
+        return false;
+    }
+    view->index = (int)index;
+    view->event_count = (uint32_t)event_count;
+    view->events_read = 0;
+    view->events = *reader;
+    
+    // Walk the events once so a bad length is caught here and iterating can't fail
+    for (uint32_t i = 0; i < view->event_count && !reader->failed; i++) {
+        wire_zigzag(reader);
+        wire_zigzag(reader);
+        uint64_t length = wire_varint(reader);
+        if (length >= UINT32_MAX) reader->failed = true;
+        wire_bytes(reader, (size_t)length);
+    }
+    if (reader->failed) return false;
+    view->events.left -= reader->left;  // The cursor ends with this block
+    view->encoded_size = (size_t)(reader->position - start);
+    return true;
+}
+
+// Next event of a view, false after the last one
+bool block_view_next_event(BlockView* view, EventView* event) {
+    if (view->events_read >= view->event_count) return false;
+    view->events_read++;
+    event->type = (int)wire_zigzag(&view->events);
+    event->timestamp = view->timestamp + wire_zigzag(&view->events);
+    event->data_length = (uint32_t)wire_varint(&view->events);
+    event->data = (const char*)wire_bytes(&view->events, event->data_length);
+    return true;
+}
+
+// Hash of the block a view encodes, from its header alone
+// Lets a receiver drop a block it already has or that misses the target before decoding its events
+void block_view_hash(const BlockView* view, Digest* output) {
+    Block header;
+    header.index = view->index;
+    header.timestamp = (time_t)view->timestamp;
+    memcpy(header.previous_hash.bytes, view->previous_hash, DIGEST_SIZE);
+    memcpy(header.merkle_root.bytes, view->merkle_root, DIGEST_SIZE);
+    header.bits = view->bits;
+    header.nonce = (int)view->nonce;
+    hash_block(&header);
+    *output = header.hash;
+}
+
+// Rebuild a block from a view, as a working block from pool (see pool_create_block)
+// Returns NULL if a payload is not text, the events don't match the Merkle root
+// or memory allocation failed
+Block* decode_block_view(BlockView* view, BlockPool* pool) {
+    Digest previous;
+    memcpy(previous.bytes, view->previous_hash, DIGEST_SIZE);
+    Block* block = pool_create_block(pool, view->index, &previous);
+    if (!block) return NULL;
+    block->timestamp = (time_t)view->timestamp;
+    block->nonce = (int)view->nonce;
+    block->bits = view->bits;
+    
+    // Payloads are hashed and copied straight out of the encoding
+    bool ok = true;
+    EventView event;
+    while (ok && block_view_next_event(view, &event)) {
+        Digest hash;
+        ok = !memchr(event.data, 0, event.data_length);
+        if (ok) hash_event_fields(event.type, event.timestamp, event.data, event.data_length, &hash);
+        ok = ok && block_append_event(block, event.type, event.data, event.data_length,
+                                      (time_t)event.timestamp, &hash);
+    }
+    
+    // The root and block hash come from what we received, not from the sender
+    block_seal_events(block);
+    if (!ok || memcmp(block->merkle_root.bytes, view->merkle_root, DIGEST_SIZE) != 0) {
+        pool_free_block(pool, block);
+        return NULL;
+    }
+    return block;
+}
+
+// Decode the block at the reader and move past it, into a working block from pool (may be NULL)
+// Returns NULL if the encoding is malformed or the events don't match the Merkle root
+Block* decode_block(WireReader* reader, BlockPool* pool) {
+    BlockView view;
+    if (!block_view_open(reader, &view)) return NULL;
+    return decode_block_view(&view, pool);
+}
+
+// Build a MSG_EVENT message
+static bool frame_event(ByteBuffer* frame, int type, const char* data) {
+    size_t length = strlen(data);
+    bool ok = length < UINT32_MAX && frame_begin(frame, MSG_EVENT) &&
+              buffer_put_zigzag(frame, type) &&
+              buffer_put_varint(frame, length) &&
+              buffer_put(frame, data, length);
+    if (ok) frame_end(frame);
+    return ok;
 }
 
 /*
- * VALIDATION FUNCTIONS
- * Ensure data integrity throughout the blockchain
+ * BLOCK LOG
+ * Optional on-disk copy of a chain (--data-dir), so a node restarts from its
+ * own disk instead of fetching the whole chain from a peer. Two files per chain:
+ *   <prefix>.blocks  append-only records, length (4) | block in the wire format
+ *   <prefix>.index   one BLOCK_LOG_ENTRY_SIZE entry per height:
+ *                    offset (8) | length (4) | height (4) | block hash (32)
+ * New blocks are appended in batches by chain_persist, off the chain's write
+ * lock. A fork or a replaced block only rewrites the index from the first
+ * changed height, the superseded records stay in the data file. Loading maps
+ * the data file and decodes blocks straight out of the mapping, a torn record
+ * at the end (crash during a write) ends the chain there.
  */
 
-void synchronize_blockchain(Node* node) {
-    // Find the longest valid chain in the network
-    int max_length = 0;
-    Node* best_node = NULL;
+// Open (or create) the log files of a chain
+// With resume false any previous content is discarded
+// Returns NULL if a file could not be opened
+BlockLog* block_log_open(const char* prefix, bool resume) {
+    char path[PATH_MAX];
+    int flags = O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC);
+    BlockLog* log = calloc(1, sizeof(BlockLog));
+    if (!log) return NULL;
     
-    pthread_mutex_lock(&nodes_lock);
-    for (int i = 0; i < node_count; i++) {
-        if (nodes[i].is_active && &nodes[i] != node) {
-            pthread_mutex_lock(&nodes[i].chain->lock);
-            if (nodes[i].chain->block_count > max_length) {
-                max_length = nodes[i].chain->block_count;
-                best_node = &nodes[i];
-            }
-            pthread_mutex_unlock(&nodes[i].chain->lock);
-        }
-    }
-    
-    // If we found a better chain, replace ours
-    if (best_node) {
-        pthread_mutex_lock(&best_node->chain->lock);
-        pthread_mutex_lock(&node->chain->lock);
-        
-        // Free our current blockchain
-        Block *current = node->chain->genesis, *next;
-        while (current) {
-            next = current->next;
-            free_block(current);
-            current = next;
-        }
-        
-        // Clone the best chain
-        current = best_node->chain->genesis;
-        node->chain->genesis = clone_block(current);
-        node->chain->block_count = 1;
-        
-        Block* prev = node->chain->genesis;
-        current = current->next;
-        
-        while (current) {
-            Block* new_block = clone_block(current);
-            prev->next = new_block;
-            prev = new_block;
-            node->chain->block_count++;
-            current = current->next;
-        }
-        
-        node->chain->last_block = prev;
-        
-        // Create a new mining block
-        if (node->chain->current_mining_block) {
-            free_block(node->chain->current_mining_block);
-        }
-        node->chain->current_mining_block = create_block(node->chain->block_count, 
-                                                         node->chain->last_block->hash);
-        
-        pthread_mutex_unlock(&node->chain->lock);
-        pthread_mutex_unlock(&best_node->chain->lock);
-        
-        printf("Node %d synchronized with node %d (chain length: %d)\n", 
-               node->id, best_node->id, max_length);
+    snprintf(path, sizeof(path), "%s.blocks", prefix);
+    log->data_fd = open(path, flags, 0644);
+    snprintf(path, sizeof(path), "%s.index", prefix);
+    log->index_fd = open(path, flags, 0644);
+    if (log->data_fd < 0 || log->index_fd < 0) {
+        fprintf(stderr, "Cannot open block log %s: %s\n", path, strerror(errno));
+        if (log->data_fd >= 0) close(log->data_fd);
+        if (log->index_fd >= 0) close(log->index_fd);
+        free(log);
+        return NULL;
     }
     
-    pthread_mutex_unlock(&nodes_lock);
+    struct stat info;
+    log->data_size = fstat(log->data_fd, &info) == 0 ? (uint64_t)info.st_size : 0;
+    log->count = fstat(log->index_fd, &info) == 0 ? (int)(info.st_size / BLOCK_LOG_ENTRY_SIZE) : 0;
+    pthread_mutex_init(&log->lock, NULL);
+    return log;
 }
-// Validate an individual event/transaction
-bool validate_event(Event* event) {
-    //  this is supposed to check signatures, account balances... in real BC 
-    // For this simulation, we just validate events of type 1 (transactions)
-    if (event->type == 1) {
-        // here assuming all transactions are valid ( is valid bool is set to true for all of them just for simulation )
-        return true;
+
+// Flush the log to disk and close it
+void block_log_close(BlockLog* log) {
+    if (!log) return;
+    fsync(log->data_fd);
+    fsync(log->index_fd);
+    close(log->data_fd);
+    close(log->index_fd);
+    buffer_free(&log->scratch);
+    pthread_mutex_destroy(&log->lock);
+    free(log);
+}
+
+// Write blocks as heights start, start + 1 ... and drop every entry above them
+// The caller holds log->lock
+// Returns false on a write error, the index then still ends at a complete entry
+static bool block_log_write(BlockLog* log, int start, Block** blocks, int count) {
+    // Records first, in one write, then the index entries that point to them
+    ByteBuffer* records = &log->scratch;
+    records->length = 0;
+    uint8_t* entries = malloc((size_t)(count > 0 ? count : 1) * BLOCK_LOG_ENTRY_SIZE);
+    if (!entries) return false;
+    
+    bool ok = true;
+    for (int i = 0; ok && i < count; i++) {
+        size_t record = records->length;
+        ok = buffer_put_u32(records, 0) && encode_block(records, blocks[i]);
+        if (!ok) break;
+        uint32_t length = (uint32_t)(records->length - record - 4);
+        put_le32(records->bytes + record, length);
+        
+        uint8_t* entry = entries + (size_t)i * BLOCK_LOG_ENTRY_SIZE;
+        put_le64(entry, log->data_size + record + 4);
+        put_le32(entry + 8, length);
+        put_le32(entry + 12, (uint32_t)blocks[i]->index);
+        memcpy(entry + 16, blocks[i]->hash.bytes, DIGEST_SIZE);
     }
     
-    // Other event types don't need special validation
-    return true;
+    size_t entry_bytes = (size_t)count * BLOCK_LOG_ENTRY_SIZE;
+    ok = ok && pwrite(log->data_fd, records->bytes, records->length, (off_t)log->data_size) == (ssize_t)records->length;
+    if (ok) log->data_size += records->length;
+    ok = ok && ftruncate(log->index_fd, (off_t)start * BLOCK_LOG_ENTRY_SIZE) == 0;
+    if (ok) log->count = start;
+    ok = ok && pwrite(log->index_fd, entries, entry_bytes, (off_t)start * BLOCK_LOG_ENTRY_SIZE) == (ssize_t)entry_bytes;
+    if (ok) log->count = start + count;
+    free(entries);
+    return ok;
 }
 
-// Validate all events in a block
-bool validate_block_events(Block* block) {
-    for (int i = 0; i < block->event_count; i++) {
-        if (!validate_event(&block->events[i])) {
-            return false;  // If any event is invalid, the block is invalid
+// Bring the on-disk copy of a chain up to date
+// Only blocks above the last persisted height, or above the lowest truncated or
+// replaced height, are written. Does nothing for a chain without a log
+void chain_persist(Blockchain* chain) {
+    BlockLog* log = chain->log;
+    if (!log) return;
+    
+    pthread_mutex_lock(&log->lock);
+    
+    // Snapshot what changed, the chain lock is only held to retain the blocks
+    chain_read_lock(chain);
+    int start = atomic_exchange(&chain->log_dirty_from, INT_MAX);
+    if (start > log->count) start = log->count;
+    if (start > chain->block_count) start = chain->block_count;
+    int count = chain->block_count - start;
+    Block** blocks = count > 0 ? malloc(count * sizeof(Block*)) : NULL;
+    for (int i = 0; blocks && i < count; i++) blocks[i] = block_retain(chain->by_height[start + i]);
+    pthread_rwlock_unlock(&chain->lock);
+    
+    if (count > 0 && !blocks) {
+        atomic_store(&chain->log_dirty_from, start);  // Retry next time
+    } else if (count > 0 || start < log->count) {
+        if (!block_log_write(log, start, blocks, count)) {
+            fprintf(stderr, "Block log write failed: %s\n", strerror(errno));
+            atomic_store(&chain->log_dirty_from, log->count);
         }
     }
-    return true;  // All events are valid
+    for (int i = 0; blocks && i < count; i++) block_release(blocks[i]);
+    free(blocks);
+    
+    pthread_mutex_unlock(&log->lock);
 }
 
-// Add an event to a block
-// Returns 1 on success, 0 if block is full
-int add_event(Block* block, int type, const char* data) {
-    if (block->event_count >= MAX_EVENTS) return 0;  // Block is full
+// Replace a chain's blocks with the ones in its log
+// Every record is decoded and checked like a block from a peer (Merkle root,
+// hash, proof of work, link to the block below), loading stops at the first bad one
+// Returns the number of blocks loaded, 0 if the log is empty (the chain is left as is)
+int chain_load_log(Blockchain* chain) {
+    BlockLog* log = chain->log;
+    if (!log) return 0;
+    pthread_mutex_lock(&log->lock);
     
-    // Expand capacity if needed (dynamic resizing)
-    if (block->event_count >= block->event_capacity) {
-        block->event_capacity *= 2;  // Double the capacity
-        
-        // But we don't exceed MAX_EVENTS
-        if (block->event_capacity > MAX_EVENTS) 
-            block->event_capacity = MAX_EVENTS;
-            
-        // Reallocate the events array
-        Event* new_events = realloc(block->events, block->event_capacity * sizeof(Event));
-        if (!new_events) return 0;  // Memory allocation failed
-        block->events = new_events;
+    int entry_count = log->count;
+    uint8_t* entries = malloc((entry_count ? entry_count : 1) * (size_t)BLOCK_LOG_ENTRY_SIZE);
+    size_t entry_bytes = (size_t)entry_count * BLOCK_LOG_ENTRY_SIZE;
+    if (!entries || pread(log->index_fd, entries, entry_bytes, 0) != (ssize_t)entry_bytes) entry_count = 0;
+    void* data = MAP_FAILED;
+    if (entry_count > 0 && log->data_size > 0) {
+        data = mmap(NULL, log->data_size, PROT_READ, MAP_PRIVATE, log->data_fd, 0);
     }
+    if (data == MAP_FAILED) entry_count = 0;
     
-    // Add the new event to the block 
-    Event* event = &block->events[block->event_count++];
-    event->type = type;
-    strncpy(event->data, data, sizeof(event->data) - 1);
-    event->data[sizeof(event->data) - 1] = '\0';  // Ensure null termination
-    
-    // Set current timestamp
-    time_t now = time(NULL);
-    strftime(event->timestamp, sizeof(event->timestamp), 
-             "%Y-%m-%d %H:%M:%S", localtime(&now));
-    
-    // Calculate hash and validate
-    hash_event(event);
-    event->is_valid = validate_event(event);
+    Block** blocks = malloc((entry_count ? entry_count : 1) * sizeof(Block*));
+    int loaded = 0;
+    for (int h = 0; blocks && h < entry_count; h++) {
+        const uint8_t* entry = entries + (size_t)h * BLOCK_LOG_ENTRY_SIZE;
+        uint64_t offset = get_le64(entry);
+        uint32_t length = get_le32(entry + 8);
+        if ((int)get_le32(entry + 12) != h || offset > log->data_size || length > log->data_size - offset) break;
+        
+        // Decoded in place from the mapping, no read buffer
+        WireReader reader = { (const uint8_t*)data + offset, length, false };
+        Block* block = decode_block(&reader, &chain->pool);
+        bool valid = block && reader.left == 0 && block->index == h &&
+                     memcmp(block->hash.bytes, entry + 16, DIGEST_SIZE) == 0 &&
+                     (h == 0 ? digest_is_zero(&block->previous_hash)
+                             : is_valid_proof(block) && block->bits == next_block_bits(blocks, h) &&
+                               digest_equal(&block->previous_hash, &blocks[h - 1]->hash));
+        Block* stored = valid ? block_publish(block) : NULL;
+        pool_free_block(&chain->pool, block);
+        if (!stored) break;
+        blocks[loaded++] = stored;
+    }
+    if (data != MAP_FAILED) munmap(data, log->data_size);
+    free(entries);
     
-    // Update block merkle root and hash
-    calculate_merkle_root(block);
-    hash_block(block);
+    if (loaded > 0) {
+        chain_write_lock(chain);
+        chain_release_blocks(chain);
+        bool appending = true;  // Out of memory the chain stops at the last block that fit
+        for (int i = 0; i < loaded; i++) {
+            appending = appending && append_block(chain, blocks[i]);
+            block_release(blocks[i]);
+        }
+        chain_reset_mining_block(chain);
+        atomic_store(&chain->log_dirty_from, INT_MAX);  // Memory and disk match again
+        pthread_rwlock_unlock(&chain->lock);
+    }
+    if (loaded < log->count) {
+        // Drop the entries we could not use, the next chain_persist rewrites them
+        if (ftruncate(log->index_fd, (off_t)loaded * BLOCK_LOG_ENTRY_SIZE) == 0) log->count = loaded;
+    }
+    free(blocks);
     
-    return 1;  // Success
+    pthread_mutex_unlock(&log->lock);
+    return loaded;
+}
+
+// Keep a chain on disk under prefix, and load what is already there when resuming
+// Returns false if the log files could not be opened
+bool chain_open_log(Blockchain* chain, const char* prefix, bool resume) {
+    chain->log = block_log_open(prefix, resume);
+    if (!chain->log) return false;
+    atomic_store(&chain->log_dirty_from, 0);  // Everything in memory is new to the log
+    if (resume) chain_load_log(chain);
+    return true;
 }
 
 /*
@@ -435,122 +4104,301 @@ int add_event(Block* block, int type, const char* data) {
  */
 
 // Create a new blockchain with a genesis block
+// Returns NULL if memory allocation failed
 Blockchain* create_blockchain() {
     Blockchain* chain = malloc(sizeof(Blockchain));
+    if (!chain) return NULL;
     
     // Create genesis block - the first block in the chain
-    Block* genesis = create_block(0, "0000000000000000000000000000000000000000000000000000000000000000");
-    calculate_merkle_root(genesis);
+    Digest zero_hash = {{0}};
+    Block* genesis = create_block(0, &zero_hash);
+    if (!genesis) {
+        free(chain);
+        return NULL;
+    }
+    if (genesis_timestamp) genesis->timestamp = genesis_timestamp;
     hash_block(genesis);
+    mempool_init(&chain->mempool);
+    block_pool_init(&chain->pool);
     
-    chain->genesis = genesis;
-    chain->last_block = genesis;
-    chain->block_count = 1;
+    chain->block_count = 0;
+    chain->last_block = NULL;
+    chain->owner = NULL;  // Set by create_blockchain_node
+    chain->consensus_id = -1;  // Counted once create_blockchain_node registers it
+    chain->checkpoint_height = -1;  // Nothing verified yet
+    chain->rewrites = 0;
+    chain->log = NULL;  // In memory only, see chain_open_log
+    atomic_init(&chain->log_dirty_from, INT_MAX);
+    atomic_init(&chain->tip, NULL);
+    Block* stored = chain_index_init(chain) ? block_publish(genesis) : NULL;
+    free_block(genesis);
+    if (!stored || !append_block(chain, stored)) {
+        if (stored) block_release(stored);
+        chain_index_free(chain);
+        block_pool_free(&chain->pool);
+        mempool_free(&chain->mempool);
+        free(chain);
+        return NULL;
+    }
+    block_release(stored);
     
     // Create the first mining block (will follow genesis)
-    chain->current_mining_block = create_block(1, genesis->hash);
+    // Without one node threads and confirm_block try again, see chain_reset_mining_block
+    chain->current_mining_block = NULL;
+    chain_reset_mining_block(chain);
     
     // Initialize mutex for thread safety
-    pthread_mutex_init(&chain->lock, NULL);
+    pthread_rwlock_init(&chain->lock, NULL);
     
     return chain;
 }
 
 // Confirm a completed block and add it to the blockchain
 void confirm_block(Blockchain* chain) {
-    pthread_mutex_lock(&chain->lock);
+    chain_write_lock(chain);
     
+    // No mining block if memory ran out making the last one, try again
+    if (!chain->current_mining_block && !chain_reset_mining_block(chain)) {
+        pthread_rwlock_unlock(&chain->lock);
+        return;
+    }
     Block* new_block = chain->current_mining_block;
+    mempool_fill_block(&chain->mempool, new_block, chain_params.max_events);
     
-    // Finalize the block by calculating its merkle root and hash
-    calculate_merkle_root(new_block);
-    hash_block(new_block);
-    
+    // Finalize the block: Merkle root, then a nonce that meets its bits
     // Add to the chain
-    chain->last_block->next = new_block;
-    chain->last_block = new_block;
-    chain->block_count++;
+    Block* stored = mine_block(new_block) ? block_publish(new_block) : NULL;
+    if (!stored || !append_block(chain, stored)) {
+        mempool_return_block(&chain->mempool, new_block);  // The events wait for the next block
+    }
+    if (stored) block_release(stored);
+    pool_free_block(&chain->pool, new_block);
     
     // Create a new mining block for future transactions
-    chain->current_mining_block = create_block(chain->block_count, new_block->hash);
+    chain->current_mining_block = NULL;
+    chain_reset_mining_block(chain);
     
-    pthread_mutex_unlock(&chain->lock);
+    pthread_rwlock_unlock(&chain->lock);
 }
 
-// Add an event to the blockchain (to the current mining block)
+// Submit an event to the blockchain: it waits in the mempool until a miner takes it
+// Returns 1 if queued, 0 if the same event is already pending or the mempool is full
 int add_blockchain_event(Blockchain* chain, int type, const char* data) {
-    pthread_mutex_lock(&chain->lock);
+    int result = mempool_add(&chain->mempool, type, data, time(NULL));
+    if (result) notify_chain_owner(chain, NODE_EVENT_TRANSACTION);  // A miner can pick it up right away
+    return result;
+}
+
+// Submit a batch of events, timestamped once and hashed in parallel (see mempool_add_batch)
+// Returns the number of events queued
+int add_blockchain_events(Blockchain* chain, const EventInput* events, int count) {
+    int queued = mempool_add_batch(&chain->mempool, events, count, time(NULL));
+    if (queued) notify_chain_owner(chain, NODE_EVENT_TRANSACTION);  // One wakeup for the whole batch
+    return queued;
+}
+
+// Free all memory used by a blockchain
+void free_blockchain(Blockchain* chain) {
+    chain_write_lock(chain);
     
-    //  add event to current mining block
-    int result = add_event(chain->current_mining_block, type, data);
+    // Release all blocks in the chain and free the mining block
+    consensus_untrack_chain(chain);
+    chain_release_blocks(chain);
+    free_block(chain->current_mining_block);
+    block_pool_free(&chain->pool);
+    mempool_free(&chain->mempool);
+    chain_index_free(chain);
     
-    // If block is full, confirm it and create a new one
-    if (result == 0) {
-        Block* old_block = chain->current_mining_block;
-        
-        // Create new mining block connected to the last confirmed block
-        chain->current_mining_block = create_block(chain->block_count, 
-                                                 chain->last_block->hash);
-        
-        pthread_mutex_unlock(&chain->lock);
+    pthread_rwlock_unlock(&chain->lock);
+    pthread_rwlock_destroy(&chain->lock);
+    block_log_close(chain->log);  // Already persisted by its node's thread
+    
+    free(chain);
+}
+
+/*
+ * CHAIN VERIFICATION
+ * Re-checks stored blocks from scratch, which is what catches a block changed
+ * after it was mined (see tamper_with_blockchain). Works on a snapshot of the
+ * chain in two parallel stages: every event hash is recomputed in one flat
+ * batch over the events of all blocks, then every block is checked on its own
+ * (Merkle root, header hash, proof of work, link to its parent). The
+ * incremental mode starts above the chain's checkpoint, the highest height
+ * it verified before, and moves the checkpoint up.
+ */
+
+#define VERIFY_MIN_BLOCKS 16        // Blocks per worker in the block stage
+
+typedef struct {
+    Block** blocks;                // Snapshot, blocks[i] is at height first_height + i (retained)
+    int block_count;
+    int first_height;
+    Block* parent;                 // Block below blocks[0], NULL when starting at genesis (retained)
+    int* event_start;              // Index of the first event of blocks[i] in the flat batch, block_count + 1 entries
+    uint32_t* expected_bits;       // Target blocks[i] needs given the chain below it, from next_block_bits
+    uint8_t* event_ok;             // Stage 1 result, per event
+    uint8_t* block_ok;             // Stage 2 result, per block
+} ChainVerifyJob;
+
+// Stage 1: recompute the hash of every event in [begin, end) of the flat batch
+static void verify_events_range(void* context, int begin, int end) {
+    ChainVerifyJob* job = (ChainVerifyJob*)context;
+    
+    // Find the block holding event begin, the rest of the range follows in order
+    int low = 0, high = job->block_count - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (job->event_start[middle] <= begin) low = middle; else high = middle - 1;
+    }
+    
+    int b = low;
+    for (int e = begin; e < end; e++) {
+        while (e >= job->event_start[b + 1]) b++;
+        Event event = get_event(job->blocks[b], e - job->event_start[b]);
+        Digest hash;
+        hash_event_fields(event.type, (int64_t)event.timestamp, event.data, event.data_length, &hash);
+        job->event_ok[e] = digest_equal(&hash, &event.hash) && validate_event(&event);
+    }
+}
+
+// Stage 2: check blocks [begin, end) of the snapshot, using the event results of stage 1
+static void verify_blocks_range(void* context, int begin, int end) {
+    ChainVerifyJob* job = (ChainVerifyJob*)context;
+    for (int b = begin; b < end; b++) {
+        const Block* block = job->blocks[b];
+        const Block* parent = b > 0 ? job->blocks[b - 1] : job->parent;
+        bool ok = block->index == job->first_height + b && block->event_count <= chain_params.max_events &&
+                  block->bits == job->expected_bits[b];
+        for (int e = job->event_start[b]; ok && e < job->event_start[b + 1]; e++) ok = job->event_ok[e];
         
-        // Mine the full block (find a valid nonce)
-        if (mine_block(old_block, DIFFICULTY)) {
-            pthread_mutex_lock(&chain->lock);
-            
-            // Check if chain has changed while we were mining
-            if (strcmp(chain->last_block->hash, old_block->previous_hash) == 0) {
-                // Chain hasn't changed, we can add our block
-                // This means no other node confirmed a block while we were mining
-                chain->last_block->next = old_block;
-                chain->last_block = old_block;
-                chain->block_count++;
-            } else {
-                // Chain has changed (another node confirmed a block first)
-                // We must discard our block to avoid a fork
-                free_block(old_block);
-            }
-            
-            pthread_mutex_unlock(&chain->lock);
-        } else {
-            // Mining was unsuccessful or interrupted
-            free_block(old_block);
+        // Merkle root from the event hashes, which stage 1 just checked
+        if (ok) {
+            Digest* level = malloc((block->event_count ? block->event_count : 1) * sizeof(Digest));
+            Digest root;
+            if (level && block->event_count > 0) memcpy(level, block->events.hash, block->event_count * sizeof(Digest));
+            if (level) merkle_root_in_place(level, block->event_count, &root);
+            ok = level && digest_equal(&root, &block->merkle_root);
+            free(level);
         }
         
-        // Try adding the event again to the new mining block
-        pthread_mutex_lock(&chain->lock);
-        result = add_event(chain->current_mining_block, type, data);
-        pthread_mutex_unlock(&chain->lock);
-        
-        return result;
+        // Header hash, then proof of work and the link to the parent (genesis is not mined)
+        if (ok) {
+            HashState midstate;
+            Digest hash;
+            hash_block_prefix(block, &midstate);
+            hash_block_nonce(&midstate, block->nonce, &hash);
+            ok = digest_equal(&hash, &block->hash);
+        }
+        if (ok && parent) {
+            ok = is_valid_proof(block) && digest_equal(&block->previous_hash, &parent->hash);
+        } else if (ok) {
+            ok = block->index == 0 && digest_is_zero(&block->previous_hash);
+        }
+        job->block_ok[b] = ok;
     }
-    
-    pthread_mutex_unlock(&chain->lock);
-    return result;
 }
 
-// Free all memory used by a blockchain
-void free_blockchain(Blockchain* chain) {
-    pthread_mutex_lock(&chain->lock);
+// Verify the blocks of a chain from from_height up to its tip
+// rewrites gets the chain's rewrite count at the time of the snapshot
+// Returns the height of the lowest invalid block, -1 if every block checked is valid
+static int verify_chain_range(Blockchain* chain, int from_height, ChainVerification* report, unsigned* rewrites) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     
-    // Free all blocks in the chain
-    Block *current = chain->genesis, *next;
+    // Snapshot: take a reference on the blocks, so the chain lock is only held while copying pointers
+    ChainVerifyJob job = {0};
+    chain_read_lock(chain);
+    if (from_height < 0) from_height = 0;
+    if (from_height > chain->block_count) from_height = chain->block_count;
+    job.first_height = from_height;
+    job.block_count = chain->block_count - from_height;
+    job.blocks = malloc((job.block_count ? job.block_count : 1) * sizeof(Block*));
+    job.event_start = malloc((job.block_count + 1) * sizeof(int));
+    job.expected_bits = malloc((job.block_count ? job.block_count : 1) * sizeof(uint32_t));
+    if (job.blocks && job.event_start && job.expected_bits) {
+        for (int i = 0; i < job.block_count; i++) {
+            job.blocks[i] = block_retain(chain->by_height[from_height + i]);
+            job.expected_bits[i] = next_block_bits(chain->by_height, from_height + i);
+        }
+        job.parent = from_height > 0 ? block_retain(chain->by_height[from_height - 1]) : NULL;
+    } else {
+        job.block_count = -1;  // Out of memory
+    }
+    if (rewrites) *rewrites = chain->rewrites;
+    pthread_rwlock_unlock(&chain->lock);
     
-    while (current) {
-        next = current->next;
-        free_block(current);
-        current = next;
+    int first_invalid = -1;
+    int event_count = 0;
+    if (job.block_count > 0) {
+        for (int i = 0; i < job.block_count; i++) {
+            job.event_start[i] = event_count;
+            event_count += job.blocks[i]->event_count;
+        }
+        job.event_start[job.block_count] = event_count;
+        job.event_ok = malloc(event_count ? event_count : 1);
+        job.block_ok = malloc(job.block_count);
+        
+        if (job.event_ok && job.block_ok) {
+            parallel_for(event_count, verify_events_range, &job);
+            parallel_for_grain(job.block_count, VERIFY_MIN_BLOCKS, verify_blocks_range, &job);
+            for (int i = 0; i < job.block_count && first_invalid < 0; i++) {
+                if (!job.block_ok[i]) first_invalid = from_height + i;
+            }
+        } else {
+            first_invalid = from_height;  // Could not check, don't vouch for anything
+        }
+        free(job.event_ok);
+        free(job.block_ok);
+    } else if (job.block_count < 0) {
+        first_invalid = from_height;
+        job.block_count = 0;
     }
     
-    // Free mining block if not already in chain
-    if (chain->current_mining_block != chain->last_block) {
-        free_block(chain->current_mining_block);
+    for (int i = 0; i < job.block_count; i++) block_release(job.blocks[i]);
+    if (job.parent) block_release(job.parent);
+    free(job.blocks);
+    free(job.event_start);
+    free(job.expected_bits);
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (report) {
+        report->from_height = from_height;
+        report->blocks = job.block_count;
+        report->events = event_count;
+        report->first_invalid = first_invalid;
+        report->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
     }
+    return first_invalid;
+}
+
+// Verify a whole chain, from genesis to the tip, report may be NULL
+// Returns the height of the lowest invalid block, -1 if the chain is valid
+int verify_chain(Blockchain* chain, ChainVerification* report) {
+    return verify_chain_range(chain, 0, report, NULL);
+}
+
+// Verify only the blocks above the chain's checkpoint, then move the checkpoint
+// up to the last valid block. Truncating or replacing blocks at or below the
+// checkpoint lowers it again (see chain_truncate / chain_replace_block)
+// Returns the height of the lowest invalid block, -1 if every block checked is valid
+int verify_chain_incremental(Blockchain* chain, ChainVerification* report) {
+    chain_read_lock(chain);
+    int from_height = chain->checkpoint_height + 1;
+    pthread_rwlock_unlock(&chain->lock);
     
-    pthread_mutex_unlock(&chain->lock);
-    pthread_mutex_destroy(&chain->lock);
+    unsigned rewrites;
+    ChainVerification local;
+    if (!report) report = &local;
+    int first_invalid = verify_chain_range(chain, from_height, report, &rewrites);
+    int verified_to = first_invalid >= 0 ? first_invalid - 1 : report->from_height + report->blocks - 1;
     
-    free(chain);
+    // Blocks only appended meanwhile don't change what was checked, anything else does
+    chain_write_lock(chain);
+    if (chain->rewrites == rewrites && verified_to > chain->checkpoint_height) {
+        chain->checkpoint_height = verified_to;
+    }
+    pthread_rwlock_unlock(&chain->lock);
+    return first_invalid;
 }
 
 /*
@@ -558,94 +4406,444 @@ void free_blockchain(Blockchain* chain) {
  * Functions for managing blockchain network nodes
  */
 
-// Get the latest confirmed block from a chain
+// Get the latest confirmed block from a chain, without locking it
+// The block is retained for the caller, who must block_release it
 Block* get_latest_block(Blockchain* chain) {
-    pthread_mutex_lock(&chain->lock);
-    Block* latest = chain->last_block;
-    pthread_mutex_unlock(&chain->lock);
-    return latest;
+    return chain_tip_acquire(chain);
 }
 
-// Broadcast a new block to all other nodes in the network
+// Whether two chains start from the same genesis block (belong to the same network)
+static bool same_genesis(Blockchain* chain, Blockchain* other) {
+    Digest genesis;
+    chain_read_lock(chain);
+    genesis = chain->by_height[0]->hash;
+    pthread_rwlock_unlock(&chain->lock);
+    
+    chain_read_lock(other);
+    bool same = other->block_count > 0 && digest_equal(&other->by_height[0]->hash, &genesis);
+    pthread_rwlock_unlock(&other->lock);
+    return same;
+}
 
-void broadcast_block(Block* block, int sender_id) {
-    pthread_mutex_lock(&nodes_lock);
+// Add blocks (in height order, the first one on top of height ancestor of our chain) to the block tree
+// The tip moves to them if their branch has more work, the blocks it leaves stay on a side branch
+// With ancestor -1 (no block in common) the chain is replaced by the blocks instead
+// The caller holds chain->lock exclusively, the chain takes over the caller's references
+// Returns the number of the blocks that are now on the main chain
+static int chain_adopt_locked(Blockchain* chain, int ancestor, Block** blocks, int count) {
+    int adopted = 0;
+    if (ancestor < 0) {
+        // Transactions of the blocks we drop go back to the mempool, the new blocks may hold them again
+        for (int h = 0; h < chain->block_count; h++) mempool_return_block(&chain->mempool, chain->by_height[h]);
+        chain_release_blocks(chain);
+        for (int i = 0; i < count; i++) {
+            bool links = chain->block_count == 0 || digest_equal(&blocks[i]->previous_hash, &chain->last_block->hash);
+            if (blocks[i]->index == chain->block_count && links && blocks[i]->bits == chain_next_bits(chain) &&
+                append_block(chain, blocks[i])) {
+                mempool_forget_block(&chain->mempool, blocks[i]);
+            }
+        }
+    } else {
+        for (int i = 0; i < count; i++) tree_attach(chain, blocks[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        if (chain_find_block(chain, &blocks[i]->hash)) adopted++;
+        block_release(blocks[i]);
+    }
     
-    for (int i = 0; i < node_count; i++) {
-        // Skip sender and inactive nodes
-        if (nodes[i].id != sender_id && nodes[i].is_active) {
-            pthread_mutex_lock(&nodes[i].chain->lock);
+    // Create a new mining block
+    chain_reset_mining_block(chain);
+    return adopted;
+}
+
+// Catch up with the chain that has the most work, if it has more than ours
+// With network_only, only chains sharing our genesis block are considered
+static void synchronize_with_longest(Node* node, bool network_only) {
+    uint64_t start = monotonic_ns();  // Only syncs that adopt something are timed
+    
+    // Find the valid chain with the most work in the network
+    chain_read_lock(node->chain);
+    ChainWork best_work = chain_tip_work(node->chain);
+    pthread_rwlock_unlock(&node->chain->lock);
+    int max_length = 0;
+    Node* best_node = NULL;
+    
+    // Only the registry is held throughout, and never two chain locks at once:
+    // the peer's missing blocks are retained first, then our chain is updated
+    nodes_read_lock();
+    for (int i = 0; i < active_count; i++) {
+        Node* peer = active_nodes[i];
+        if (peer != node) {
+            chain_read_lock(peer->chain);
+            ChainWork work = chain_tip_work(peer->chain);
+            pthread_rwlock_unlock(&peer->chain->lock);
+            if (work > best_work && (!network_only || same_genesis(node->chain, peer->chain))) {
+                best_work = work;
+                best_node = peer;
+            }
+        }
+    }
+    
+    // If we found a better chain, replace ours
+    if (best_node) {
+        Blockchain* chain = node->chain;
+        Blockchain* best = best_node->chain;
+        
+        // Walk down from the shorter tip until the peer knows our block,
+        // so only the blocks mined while we were away are transferred
+        chain_read_lock(chain);
+        int height = chain->block_count - 1;
+        pthread_rwlock_unlock(&chain->lock);
+        
+        int ancestor = -1;
+        Block** missing = NULL;
+        int missing_count = 0;
+        while (true) {
+            Digest hash;
+            chain_read_lock(chain);
+            if (height >= chain->block_count) height = chain->block_count - 1;
+            if (height >= 0) hash = chain->by_height[height]->hash;
+            pthread_rwlock_unlock(&chain->lock);
             
-            // Check if block is valid 
-            if (is_valid_proof(block, DIFFICULTY) && validate_block_events(block)) {
-                // Check if this block builds on a block we have
-                bool can_add = false;
-                Block* current = nodes[i].chain->genesis;
-                
-                while (current) {
-                    if (strcmp(current->hash, block->previous_hash) == 0) {
-                        can_add = true;
-                        break;
-                    }
-                    current = current->next;
-                }
-                
-                if (can_add) {
-                    // Block is valid and builds on our chain
-                    Block* new_block = clone_block(block);
-                    
-                    // Check if this creates a longer chain
-                    int new_chain_length = block->index + 1;
-                    if (new_chain_length > nodes[i].chain->block_count) {
-                        // This is a longer chain, update our last block
-                        current->next = new_block;
-                        nodes[i].chain->last_block = new_block;
-                        nodes[i].chain->block_count = new_chain_length;
-                        
-                        // Update mining block to build on the new block
-                        free_block(nodes[i].chain->current_mining_block);
-                        nodes[i].chain->current_mining_block = create_block(nodes[i].chain->block_count, 
-                                                                         new_block->hash);
-                    }
+            chain_read_lock(best);
+            if (height >= best->block_count) {
+                // The peer's chain is shorter (it has more work): start at its tip height,
+                // with our hash at that height
+                height = best->block_count - 1;
+                pthread_rwlock_unlock(&best->lock);
+                continue;
+            }
+            bool shared = height >= 0 && chain_find_block(best, &hash);
+            if (shared || height < 0) {
+                // Take a reference on every block above the ancestor
+                ancestor = height;
+                max_length = best->block_count;
+                missing_count = max_length - (ancestor + 1);
+                missing = malloc((missing_count ? missing_count : 1) * sizeof(Block*));
+                for (int i = 0; missing && i < missing_count; i++) {
+                    missing[i] = block_retain(best->by_height[ancestor + 1 + i]);
                 }
             }
-            
-            pthread_mutex_unlock(&nodes[i].chain->lock);
+            pthread_rwlock_unlock(&best->lock);
+            if (shared || height < 0) break;
+            height--;
+        }
+        if (!missing) {
+            // Out of memory: our chain stays as it is, the next block that doesn't attach retries
+            pthread_rwlock_unlock(&nodes_lock);
+            return;
+        }
+        
+        chain_write_lock(chain);
+        int fetched = chain_adopt_locked(chain, ancestor, missing, missing_count);
+        int kept = chain->block_count - fetched;
+        pthread_rwlock_unlock(&chain->lock);
+        free(missing);
+        
+        atomic_store(&node->mining_cancel, true);  // Its miner should move to the new tip
+        node_notify(node, NODE_EVENT_TIP);
+        metrics_span(TIMER_SYNC, "sync", start, fetched);
+        
+        // Like the per-block lines, off with --quiet: TIMER_SYNC already counts every sync
+        if (log_blocks) {
+            printf("Node %d synchronized with node %d (chain length: %d, %d blocks kept, %d fetched)\n",
+                   node->id, best_node->id, max_length, kept, fetched);
         }
     }
     
-    pthread_mutex_unlock(&nodes_lock);
+    pthread_rwlock_unlock(&nodes_lock);
 }
-// Tamper with a transaction (malicious node behavior)
-// This simulates an attack on the blockchain
-void tamper_with_blockchain(Node* node) {
-    if (!node->is_malicious || !node->is_active) return;
+
+// Catch up with the longest chain in the network (used when a node comes back online)
+void synchronize_blockchain(Node* node) {
+    synchronize_with_longest(node, false);
+}
+
+/*
+ * NETWORK PEERS
+ * Connections to nodes in other processes. Any thread may queue a message for a
+ * peer: it is written right away if the socket takes it, otherwise it waits in the
+ * peer's output buffer and the transport loop flushes it once the socket is
+ * writable. Only the transport thread reads from sockets and closes them.
+ */
+
+// Mark a peer as broken and let the transport thread close it
+static void peer_fail(Peer* peer) {
+    atomic_store(&peer->failed, true);
+    uint64_t one = 1;
+    if (write(transport.wake_fd, &one, sizeof(one)) < 0) {
+        // The loop also looks for failed peers every RECONNECT_INTERVAL_MS
+    }
+}
+
+// Write as much queued output as the socket takes, the caller holds peer->lock
+static void peer_flush_locked(Peer* peer) {
+    while (peer->output_sent < peer->output.length) {
+        ssize_t written = send(peer->fd, peer->output.bytes + peer->output_sent,
+                               peer->output.length - peer->output_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written > 0) {
+            peer->output_sent += (size_t)written;
+            atomic_fetch_add(&transport.bytes_out, (unsigned long long)written);
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            peer_fail(peer);
+            return;
+        }
+    }
+    if (peer->output_sent == peer->output.length) {
+        peer->output.length = 0;
+        peer->output_sent = 0;
+    }
     
-    pthread_mutex_lock(&node->chain->lock);
+    // Have the loop wait for the socket to drain only while something is left
+    bool want_write = peer->output.length > 0;
+    if (want_write != peer->want_write) {
+        struct epoll_event event = { .events = EPOLLIN | (want_write ? EPOLLOUT : 0), .data.ptr = peer };
+        epoll_ctl(transport.epoll_fd, EPOLL_CTL_MOD, peer->fd, &event);
+        peer->want_write = want_write;
+    }
+}
+
+// Queue a complete message for a peer and try to send it
+static void peer_send(Peer* peer, const ByteBuffer* frame) {
+    if (atomic_load(&peer->failed)) return;
     
-    // Find a block to tamper with 
-    Block* current = node->chain->genesis->next;
-    if (current == NULL) {
-        pthread_mutex_unlock(&node->chain->lock);
-        return;
+    pthread_mutex_lock(&peer->lock);
+    if (peer->output.length - peer->output_sent + frame->length > PEER_OUTPUT_LIMIT) {
+        peer_fail(peer);  // Not reading fast enough to keep up with us
+    } else if (buffer_put(&peer->output, frame->bytes, frame->length)) {
+        atomic_fetch_add(&transport.messages_out, 1);
+        if (!peer->connecting) peer_flush_locked(peer);
+    }
+    pthread_mutex_unlock(&peer->lock);
+}
+
+// Send a message to every connected peer except skip
+static void peers_send_all(const ByteBuffer* frame, const Peer* skip) {
+    pthread_mutex_lock(&transport.peers_lock);
+    for (int i = 0; i < transport.peer_count; i++) {
+        Peer* peer = transport.peers[i];
+        if (peer != skip && peer->ready) peer_send(peer, frame);
+    }
+    pthread_mutex_unlock(&transport.peers_lock);
+}
+
+// Send a stored block to the nodes in other processes, except the peer it came from
+// The block is encoded once for all peers
+void peers_send_block(const Block* block, const Peer* skip) {
+    if (!atomic_load(&transport.running)) return;
+    
+    ByteBuffer frame = {0};
+    if (frame_begin(&frame, MSG_BLOCK) && encode_block(&frame, block)) {
+        frame_end(&frame);
+        peers_send_all(&frame, skip);
+    }
+    buffer_free(&frame);
+}
+
+/*
+ * NODE INBOX
+ * Broadcast blocks are queued per node instead of being applied by the sender.
+ * The inbox is a bounded ring (Vyukov's MPMC queue with a single consumer):
+ * every slot carries a sequence number, so producers claim slots with one CAS
+ * on head and the consumer needs no atomics besides the slot sequence.
+ */
+
+// Set up an empty inbox
+void inbox_init(Inbox* inbox) {
+    for (size_t i = 0; i < INBOX_CAPACITY; i++) {
+        atomic_init(&inbox->slots[i].sequence, i);
+        inbox->slots[i].block = NULL;
     }
+    atomic_init(&inbox->head, 0);
+    inbox->tail = 0;
+    atomic_init(&inbox->delivered, 0);
+    atomic_init(&inbox->dropped, 0);
+    inbox->dropped_seen = 0;
+}
+
+// Queue a block for a node, never blocks
+// Returns false if the inbox is full (the caller keeps its reference)
+bool inbox_push(Inbox* inbox, Block* block) {
+    size_t position = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+    InboxSlot* slot;
+    while (true) {
+        slot = &inbox->slots[position & (INBOX_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t lag = (intptr_t)sequence - (intptr_t)position;
+        if (lag == 0) {
+            // Slot is free, claim it
+            if (atomic_compare_exchange_weak_explicit(&inbox->head, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (lag < 0) {
+            // Slot still holds a block from the previous lap: full
+            atomic_fetch_add_explicit(&inbox->dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            position = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+        }
+    }
+    slot->block = block;
+    slot->queued = monotonic_ns();
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    atomic_fetch_add_explicit(&inbox->delivered, 1, memory_order_relaxed);
+    return true;
+}
+
+// Take the oldest queued block, NULL if the inbox is empty
+// queued (may be NULL) gets the time it was pushed. Only the node's own thread may call this
+Block* inbox_pop(Inbox* inbox, uint64_t* queued) {
+    InboxSlot* slot = &inbox->slots[inbox->tail & (INBOX_CAPACITY - 1)];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence != inbox->tail + 1) return NULL;
+    Block* block = slot->block;
+    if (queued) *queued = slot->queued;
+    atomic_store_explicit(&slot->sequence, inbox->tail + INBOX_CAPACITY, memory_order_release);
+    inbox->tail++;
+    return block;
+}
+
+// Release every block still queued (the node is being shut down)
+void inbox_clear(Inbox* inbox) {
+    Block* block;
+    while ((block = inbox_pop(inbox, NULL))) block_release(block);
+}
+
+// Hand a stored, validated block to every local node except sender_id
+// Each node gets a reference in its inbox and applies it on its own thread,
+// so the sender never waits on a peer's chain lock
+static void deliver_block(Block* block, int sender_id) {
+    nodes_read_lock();
     
-    // Attempt to modify a transaction in this block
-    if (current->event_count > 0) {
-        // Modify data of first transaction
-        if (current->events[0].type == 1) {
-            // Replace transaction data with fraudulent data
-            strcpy(current->events[0].data, "{\"from\":\"System\",\"to\":\"Hacker\",\"amount\":1000}");
-            
-            // Recalculate event hash
-            hash_event(&current->events[0]);
+    for (int i = 0; i < active_count; i++) {
+        Node* peer = active_nodes[i];
+        if (peer->id != sender_id) {
+            // A block on top of the peer's tip makes the block it is mining stale
+            ChainTip tip = get_chain_tip(peer->chain);
+            if (digest_equal(&tip.hash, &block->previous_hash)) {
+                atomic_store(&peer->mining_cancel, true);
+            }
             
-            printf("Node %d (malicious) tampered with transaction in block %d\n", 
-                   node->id, current->index);
+            block_retain(block);
+            if (!inbox_push(&peer->inbox, block)) {
+                block_release(block);  // Peer is backed up, it resyncs once it sees the drop
+            }
+            node_notify(peer, NODE_EVENT_BLOCK);
+        }
+    }
+    
+    pthread_rwlock_unlock(&nodes_lock);
+}
+
+// Broadcast a new stored block to all other nodes in the network,
+// in this process and over the transport
+void broadcast_block(Block* block, int sender_id) {
+    // Stored blocks are immutable, so the proof and events are checked once, outside any lock
+    if (!is_valid_proof(block) || !validate_block_events(block)) return;
+    
+    deliver_block(block, sender_id);
+    peers_send_block(block, NULL);
+}
+
+// Apply one received block to a chain, the caller must hold chain->lock
+// Returns 1 if the chain tip moved, 0 if the block went to a side branch or was ignored,
+// -1 if it is ahead of our tip but its parent is unknown (we missed blocks)
+static int receive_block(Blockchain* chain, Block* block) {
+    int result = tree_attach(chain, block);
+    if (result < 0 && block->index < chain->block_count) return 0;  // Kept as an orphan, no need to resync for it
+    return result;
+}
+
+// Apply the blocks waiting in a node's inbox, INBOX_BATCH per chain lock
+// Called from the node's own thread only
+void drain_inbox(Node* node) {
+    Inbox* inbox = &node->inbox;
+    Block* batch[INBOX_BATCH];
+    uint64_t queued[INBOX_BATCH];
+    bool behind = false;
+    int count;
+    do {
+        count = 0;
+        while (count < INBOX_BATCH && (batch[count] = inbox_pop(inbox, &queued[count]))) count++;
+        if (count == 0) break;
+        
+        uint64_t start = monotonic_ns();
+        chain_write_lock(node->chain);
+        bool extended = false;
+        for (int i = 0; i < count; i++) {
+            int result = receive_block(node->chain, batch[i]);
+            if (result > 0) {
+                extended = true;
+            } else if (result < 0) {
+                behind = true;
+            }
+        }
+        if (extended) {
+            // Update mining block to build on the new tip
+            chain_reset_mining_block(node->chain);
         }
+        pthread_rwlock_unlock(&node->chain->lock);
+        
+        uint64_t applied = monotonic_ns();
+        trace_span("apply blocks", start, applied, count);
+        metrics_count(COUNTER_BLOCKS_APPLIED, count);
+        for (int i = 0; i < count; i++) {
+            metrics_time(TIMER_DELIVERY, queued[i], applied);
+            block_release(batch[i]);
+        }
+    } while (count == INBOX_BATCH);
+    
+    // Blocks were dropped while we were backed up, so the chain may have a gap: catch up
+    unsigned long long dropped = atomic_load_explicit(&inbox->dropped, memory_order_relaxed);
+    if (dropped != inbox->dropped_seen) {
+        inbox->dropped_seen = dropped;
+        behind = true;
+    }
+    // We missed blocks: catch up with the chain of our network that has the most work
+    // (races between two miners no longer need this, the losing block stays on a side branch)
+    if (behind) synchronize_with_longest(node, true);
+    
+    // New blocks go to disk in one batch, outside the chain's write lock
+    chain_persist(node->chain);
+    consensus_deliver_finalized();
+}
+
+// Replace the first transaction of the block at height with fraudulent data
+// The event hash changes, the block's Merkle root and hash don't: verification has to catch it
+// The caller must hold chain->lock for writing
+// Returns false if the block has no transaction to change or memory allocation failed
+bool forge_block_event(Blockchain* chain, int height) {
+    Block* current = chain_block_at(chain, height);
+    if (!current || current->event_count == 0 || current->events.type[0] != 1) return false;
+    
+    // Stored blocks are shared and immutable, so the forged version is a new
+    // block that only this chain points to
+    Block* forged = pool_clone_block(&chain->pool, current);
+    if (!forged) return false;
+    if (!block_set_event_data(forged, 0, "{\"from\":\"System\",\"to\":\"Hacker\",\"amount\":1000}")) {
+        pool_free_block(&chain->pool, forged);
+        return false;
     }
+    Block* stored = block_publish(forged);
+    pool_free_block(&chain->pool, forged);
+    if (!stored) return false;
+    chain_replace_block(chain, current, stored);
+    return true;
+}
+
+// Tamper with a transaction (malicious node behavior)
+// This simulates an attack on the blockchain
+void tamper_with_blockchain(Node* node) {
+    if (!node->is_malicious || !atomic_load(&node->is_active)) return;
     
-    pthread_mutex_unlock(&node->chain->lock);
+    chain_write_lock(node->chain);
+    if (forge_block_event(node->chain, 1)) {
+        printf("Node %d (malicious) tampered with transaction in block 1\n", node->id);
+    }
+    pthread_rwlock_unlock(&node->chain->lock);
 }
 
 // Calculate the longest chain among all nodes
@@ -653,20 +4851,15 @@ void tamper_with_blockchain(Node* node) {
 int get_longest_chain_length() {
     int max_length = 0;
     
-    pthread_mutex_lock(&nodes_lock);
+    nodes_read_lock();
     
     // Check each active node's chain length
-    for (int i = 0; i < node_count; i++) {
-        if (nodes[i].is_active) {
-            pthread_mutex_lock(&nodes[i].chain->lock);
-            if (nodes[i].chain->block_count > max_length) {
-                max_length = nodes[i].chain->block_count;
-            }
-            pthread_mutex_unlock(&nodes[i].chain->lock);
-        }
+    for (int i = 0; i < active_count; i++) {
+        int length = get_chain_tip(active_nodes[i]->chain).height + 1;  // No chain lock needed
+        if (length > max_length) max_length = length;
     }
     
-    pthread_mutex_unlock(&nodes_lock);
+    pthread_rwlock_unlock(&nodes_lock);
     
     return max_length;
 }
@@ -676,52 +4869,116 @@ int get_longest_chain_length() {
  * The main operation loop for each blockchain node
  */
 
+// Working copy of the chain's mining block for one round of mining
+// A mining block that couldn't be made when the tip last moved is made now
+// Returns NULL if memory allocation failed, the node tries again next round
+static Block* node_copy_mining_block(Node* node) {
+    Blockchain* chain = node->chain;
+    chain_read_lock(chain);
+    Block* copy = chain->current_mining_block ? pool_clone_block(&chain->pool, chain->current_mining_block) : NULL;
+    bool missing = !chain->current_mining_block;
+    pthread_rwlock_unlock(&chain->lock);
+    if (!missing) return copy;
+    
+    chain_write_lock(chain);
+    if (chain->current_mining_block || chain_reset_mining_block(chain)) {
+        copy = pool_clone_block(&chain->pool, chain->current_mining_block);
+    }
+    pthread_rwlock_unlock(&chain->lock);
+    return copy;
+}
+
 // Node thread function - handles mining and other operations
 void* node_thread(void* arg) {
     Node* node = (Node*)arg;
+    char name[24];
+    snprintf(name, sizeof(name), "node %d", node->id);
+    metrics_name_thread(name);
     
-    while (!shutdown_requested && node->is_active) {
-        if (node->is_mining) {
-            // Copy current mining block to work on independently
-            pthread_mutex_lock(&node->chain->lock);
-            Block* mining_block = clone_block(node->chain->current_mining_block);
-            pthread_mutex_unlock(&node->chain->lock);
+    while (!atomic_load(&shutdown_requested) && atomic_load(&node->is_active)) {
+        // Apply blocks broadcast by other nodes first, so we mine on the newest tip
+        // Any block arriving from now on cancels the job below if it makes it stale
+        atomic_store(&node->mining_cancel, false);
+        drain_inbox(node);
+        
+        // Copy current mining block to work on independently
+        Block* mining_block = node->is_mining ? node_copy_mining_block(node) : NULL;
+        if (mining_block) {
+            // Fill the block template with pending transactions
+            mempool_fill_block(&node->chain->mempool, mining_block, chain_params.max_events);
             
-            // Mine the block (Proof of Work)
-            bool success = mine_block(mining_block, DIFFICULTY);
+            // Mine the block (Proof of Work), stop early if a competing block arrives
+            MiningStats stats;
+            uint64_t start = monotonic_ns();
+            bool success = mine_block_cancellable(mining_block, &node->mining_cancel, &stats);
+            metrics_span(TIMER_MINING, "mine", start, mining_block->index);
+            metrics_count(COUNTER_HASHES, stats.hashes);
             
-            if (success && node->is_active) {
-                printf("Node %d mined block %d with nonce %d: %s\n", 
-                       node->id, mining_block->index, mining_block->nonce, mining_block->hash);
+            if (!success && atomic_load(&node->mining_cancel)) {
+                // The tip moved under us: start over on the new tip right away
+                metrics_count(COUNTER_CANCELLED_JOBS, 1);
+                atomic_fetch_add(&node->cancelled_jobs, 1);
+                atomic_fetch_add(&node->cancelled_hashes, stats.hashes);
+                mempool_return_block(&node->chain->mempool, mining_block);
+                pool_free_block(&node->chain->pool, mining_block);
+                continue;
+            }
+            
+            // Blocks that arrived while we were hashing may make ours stale, apply them first
+            if (success) drain_inbox(node);
+            
+            if (success && atomic_load(&node->is_active)) {
+                if (log_blocks) {
+                    char hash_hex[HASH_SIZE+1];
+                    digest_to_hex(&mining_block->hash, hash_hex);
+                    printf("Node %d mined block %d with nonce %d: %s (%llu hashes, %.0f H/s)\n", 
+                           node->id, mining_block->index, mining_block->nonce, hash_hex,
+                           stats.hashes, stats.hash_rate);
+                }
                 
-                pthread_mutex_lock(&node->chain->lock);
+                chain_write_lock(node->chain);
                 
                 // Ensure the chain hasn't changed while mining
-                if (strcmp(node->chain->last_block->hash, mining_block->previous_hash) == 0) {
+                if (digest_equal(&node->chain->last_block->hash, &mining_block->previous_hash)) {
                     // Chain hasn't changed, we can add our block
                     // This means we won the mining race for this block
-                    node->chain->last_block->next = mining_block;
-                    node->chain->last_block = mining_block;
-                    node->chain->block_count++;
+                    Block* stored = block_publish(mining_block);
+                    if (stored && !append_block(node->chain, stored)) {
+                        block_release(stored);
+                        stored = NULL;
+                    }
+                    if (stored) {
+                        metrics_count(COUNTER_BLOCKS_MINED, 1);
+                    } else {
+                        // Out of memory publishing or appending it: give the events back and mine again
+                        mempool_return_block(&node->chain->mempool, mining_block);
+                    }
                     
                     // Create new mining block
-                    free_block(node->chain->current_mining_block);
-                    node->chain->current_mining_block = create_block(node->chain->block_count, 
-                                                                 mining_block->hash);
+                    chain_reset_mining_block(node->chain);
                     
-                    pthread_mutex_unlock(&node->chain->lock);
+                    pthread_rwlock_unlock(&node->chain->lock);
+                    pool_free_block(&node->chain->pool, mining_block);
                     
-                    // Broadcast the new block to other nodes
-                    broadcast_block(mining_block, node->id);
+                    // Broadcast the new block to other nodes, they share the stored copy
+                    if (stored) {
+                        broadcast_block(stored, node->id);
+                        block_release(stored);
+                    }
+                    consensus_deliver_finalized();
                 } else {
                     // Chain has changed while we were mining
                     // Another node already mined a valid block, so discard ours
-                    pthread_mutex_unlock(&node->chain->lock);
-                    free_block(mining_block);
+                    pthread_rwlock_unlock(&node->chain->lock);
+                    metrics_count(COUNTER_STALE_BLOCKS, 1);
+                    atomic_fetch_add(&node->stale_blocks, 1);
+                    mempool_return_block(&node->chain->mempool, mining_block);
+                    pool_free_block(&node->chain->pool, mining_block);
                 }
             } else {
-                // Mining failed or was interrupted
-                free_block(mining_block);
+                // Mining failed or was interrupted, its transactions wait for the next block
+                mempool_return_block(&node->chain->mempool, mining_block);
+                pool_free_block(&node->chain->pool, mining_block);
             }
             
             // Malicious node behavior - occasionally try to tamper with the chain
@@ -731,9 +4988,20 @@ void* node_thread(void* arg) {
             }
         }
         
-        usleep(50000);  // 50ms pause to prevent CPU overload
+        // Sleep until there is something to do. Blocks are applied as soon as they arrive.
+        // Miners start the next block after MINING_INTERVAL_MS (this paces the demo),
+        // or right away when a transaction comes in or the tip moves under them.
+        // Validators have no timer at all, they only wake for blocks.
+        struct timespec deadline = deadline_after_ms(MINING_INTERVAL_MS);
+        while (!atomic_load(&shutdown_requested) && atomic_load(&node->is_active)) {
+            unsigned events = node_wait(node, node->is_mining ? &deadline : NULL);
+            if (events & NODE_EVENT_BLOCK) drain_inbox(node);
+            if (!node->is_mining) continue;
+            if (events == 0 || (events & (NODE_EVENT_TRANSACTION | NODE_EVENT_TIP))) break;
+        }
     }
     
+    chain_persist(node->chain);  // Last blocks mined or received before stopping
     return NULL;
 }
 
@@ -742,25 +5010,104 @@ void* node_thread(void* arg) {
  * Create, start, and stop network nodes
  */
 
+// Make room for one more node in the registry, the caller holds nodes_lock for writing
+// Returns false if memory allocation failed
+static bool registry_reserve(void) {
+    if (node_count < node_capacity) return true;
+    
+    int capacity = node_capacity ? node_capacity * 2 : NODE_REGISTRY_INITIAL;
+    Node** grown_nodes = realloc(nodes, capacity * sizeof(Node*));
+    if (!grown_nodes) return false;
+    nodes = grown_nodes;
+    Node** grown_active = realloc(active_nodes, capacity * sizeof(Node*));
+    if (!grown_active) return false;
+    active_nodes = grown_active;
+    
+    node_capacity = capacity;
+    return true;
+}
+
+// Put a node in the active list, the caller holds nodes_lock for writing
+static void registry_activate(Node* node) {
+    atomic_store(&node->is_active, true);
+    node->active_slot = active_count;
+    active_nodes[active_count++] = node;
+}
+
+// Take a node out of the active list in O(1): the last active node takes its slot
+// The caller holds nodes_lock for writing
+static void registry_deactivate(Node* node) {
+    atomic_store(&node->is_active, false);
+    Node* last = active_nodes[--active_count];
+    active_nodes[node->active_slot] = last;
+    last->active_slot = node->active_slot;
+    node->active_slot = -1;
+}
+
+// Free every node and the registry, once all node threads have been joined
+void free_node_registry(void) {
+    for (int i = 0; i < node_count; i++) {
+        inbox_clear(&nodes[i]->inbox);
+        free_blockchain(nodes[i]->chain);
+        pthread_mutex_destroy(&nodes[i]->wait_lock);
+        pthread_cond_destroy(&nodes[i]->wakeup);
+        free(nodes[i]);
+    }
+    free(nodes);
+    free(active_nodes);
+    nodes = active_nodes = NULL;
+    node_count = active_count = node_capacity = 0;
+}
+
 // Create a new blockchain node
+// Returns NULL if memory allocation failed
 Node* create_blockchain_node(bool is_mining, bool is_malicious) {
-    pthread_mutex_lock(&nodes_lock);
+    Node* node = calloc(1, sizeof(Node));
+    if (!node) return NULL;
     
-    // Check if we have space for more nodes
-    if (node_count >= MAX_NODES) {
-        pthread_mutex_unlock(&nodes_lock);
+    // The chain is built and its log loaded before the registry is locked: loading a log
+    // checks every block's proof of work, and deliveries and syncs must not wait for that.
+    // Creations are serialized instead, so the id taken here is the one registered below.
+    pthread_mutex_lock(&node_create_lock);
+    node->id = node_count;              // Only changed by creators, who hold node_create_lock
+    node->chain = create_blockchain();  // Each node has its own copy of the blockchain
+    if (!node->chain) {
+        pthread_mutex_unlock(&node_create_lock);
+        free(node);
         return NULL;
     }
-    
-    // Initialize the new node
-    Node* node = &nodes[node_count];
-    node->id = node_count++;
-    node->chain = create_blockchain();  // Each node has its own copy of the blockchain
+    node->chain->owner = node;          // Transactions added to the chain wake this node
+    if (data_dir) {
+        char prefix[PATH_MAX];
+        snprintf(prefix, sizeof(prefix), "%s/node-%d", data_dir, node->id);
+        chain_open_log(node->chain, prefix, data_resume);
+        // Read before the node's thread starts, it appends to the log without the chain lock
+        if (node->chain->log && node->chain->block_count > 1)
+            printf("Node %d resumed from %s at height %d\n", node->id, data_dir, node->chain->block_count - 1);
+    }
     node->is_mining = is_mining;        // Whether this node will mine new blocks
     node->is_malicious = is_malicious;  // Whether this node will try to cheat
-    node->is_active = true;             // Node starts active
     
-    pthread_mutex_unlock(&nodes_lock);
+    nodes_write_lock();
+    
+    // Grow the registry if it is full
+    if (!registry_reserve()) {
+        pthread_rwlock_unlock(&nodes_lock);
+        pthread_mutex_unlock(&node_create_lock);
+        free_blockchain(node->chain);
+        free(node);
+        return NULL;
+    }
+    nodes[node_count++] = node;
+    chain_write_lock(node->chain);
+    consensus_track_chain(node->chain, node->id);  // Its blocks count towards consensus while it is online
+    pthread_rwlock_unlock(&node->chain->lock);
+    registry_activate(node);            // Node starts active
+    inbox_init(&node->inbox);           // Nothing received yet
+    node_events_init(node);
+    
+    pthread_rwlock_unlock(&nodes_lock);
+    pthread_mutex_unlock(&node_create_lock);
     
     // Start the node's processing thread
     pthread_create(&node->thread, NULL, node_thread, node);
@@ -770,91 +5117,727 @@ Node* create_blockchain_node(bool is_mining, bool is_malicious) {
 
 // Stop a node (take it offline) - to test the 4th test of availability apres
 void stop_node(int node_id) {
-    pthread_mutex_lock(&nodes_lock);
+    nodes_write_lock();
     
     // Validate node_id
     if (node_id < 0 || node_id >= node_count) {
-        pthread_mutex_unlock(&nodes_lock);
+        pthread_rwlock_unlock(&nodes_lock);
         return;
     }
     
     // Mark the node as inactive
-    nodes[node_id].is_active = false;
+    Node* node = nodes[node_id];
+    if (!atomic_load(&node->is_active)) {
+        pthread_rwlock_unlock(&nodes_lock);
+        return;
+    }
+    registry_deactivate(node);
+    chain_write_lock(node->chain);
+    consensus_untrack_chain(node->chain);  // An offline node no longer counts
+    pthread_rwlock_unlock(&node->chain->lock);
+    atomic_store(&node->mining_cancel, true);
+    node_notify(node, NODE_EVENT_STOP);  // Wake it so it sees the flag
     
-    pthread_mutex_unlock(&nodes_lock);
+    pthread_rwlock_unlock(&nodes_lock);
     
     // Wait for node's thread to terminate
-    pthread_join(nodes[node_id].thread, NULL);
+    pthread_join(node->thread, NULL);
+    
+    // A persistent node loses its memory like a real shutdown, start_node reads its disk
+    BlockLog* log = node->chain->log;
+    if (log) {
+        chain_persist(node->chain);
+        chain_write_lock(node->chain);
+        if (log->count == node->chain->block_count) chain_release_blocks(node->chain);
+        pthread_rwlock_unlock(&node->chain->lock);
+    }
     
     printf("Node %d stopped\n", node_id);
 }
 
+// Reload the chain of a stopped persistent node from its disk, before it goes back online
+static void cold_start_node(Node* node) {
+    Blockchain* chain = node->chain;
+    if (!chain->log || get_chain_tip(chain).height >= 0) return;  // Never lost its memory
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int loaded = chain_load_log(chain);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Node %d loaded %d blocks from disk in %.2f ms\n", node->id, loaded,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    
+    // Nothing usable on disk: fetch the whole chain before the node's thread needs a tip
+    if (loaded == 0) synchronize_blockchain(node);
+}
+
 // Start a previously stopped node (bring it back online)
 void start_node(int node_id) {
-    pthread_mutex_lock(&nodes_lock);
+    nodes_read_lock();
+    Node* node = node_id >= 0 && node_id < node_count ? nodes[node_id] : NULL;
+    bool offline = node && !atomic_load(&node->is_active);
+    pthread_rwlock_unlock(&nodes_lock);
+    if (offline) cold_start_node(node);  // Offline, so no other thread uses its chain
+    
+    nodes_write_lock();
     
     // Validate node_id
     if (node_id < 0 || node_id >= node_count) {
-        pthread_mutex_unlock(&nodes_lock);
+        pthread_rwlock_unlock(&nodes_lock);
         return;
     }
     
-    // Only restart if it's currently inactive
-    if (!nodes[node_id].is_active) {
-        nodes[node_id].is_active = true;
+    // Only restart if it's currently inactive and has a chain to work on
+    if (!atomic_load(&node->is_active) && get_chain_tip(node->chain).height < 0) {
+        pthread_rwlock_unlock(&nodes_lock);
+        printf("Node %d has no chain to resume from\n", node_id);
+        return;
+    }
+    if (!atomic_load(&node->is_active)) {
+        chain_write_lock(node->chain);
+        consensus_track_chain(node->chain, node->id);
+        pthread_rwlock_unlock(&node->chain->lock);
+        registry_activate(node);
         
         // Start a new processing thread for this node
-        pthread_create(&nodes[node_id].thread, NULL, node_thread, &nodes[node_id]);
+        pthread_create(&node->thread, NULL, node_thread, node);
         
         printf("Node %d started\n", node_id);
         
         // Add synchronization after starting
-        pthread_mutex_unlock(&nodes_lock);
-        synchronize_blockchain(&nodes[node_id]);
+        pthread_rwlock_unlock(&nodes_lock);
+        synchronize_blockchain(node);
         return;
     }
     
-    pthread_mutex_unlock(&nodes_lock);
+    pthread_rwlock_unlock(&nodes_lock);
 }
 
 /*
- * CONSENSUS FUNCTIONS
- * Determine agreement across the network
+ * NETWORK TRANSPORT
+ * Links the local node to nodes in other processes over TCP. One thread runs
+ * an epoll loop over the listening socket and every peer connection: it
+ * accepts and dials peers, reads messages and applies them (blocks go through
+ * the node's inbox like local broadcasts), and redials configured peers that
+ * dropped. A node that sees a block it can't attach asks the sender for the
+ * blocks after the last hash both chains share (MSG_GET_BLOCKS with a locator).
  */
 
-// Check if majority of active nodes have a particular block (consensus)
-// This is how we determine if a block is accepted by the network
-bool check_consensus(Block* block) {
-    int total_active = 0;          // Total active nodes
-    int nodes_with_block = 0;      // Nodes that have this block
+// Milliseconds on the monotonic clock, for the redial timer
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Register a connected (or connecting) socket as a peer
+// Returns NULL if memory allocation failed, the socket is closed then
+static Peer* peer_create(int fd, const char* address, int seed, bool connecting) {
+    Peer* peer = calloc(1, sizeof(Peer));
+    if (!peer) {
+        close(fd);
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // Blocks are small and latency matters
     
-    pthread_mutex_lock(&nodes_lock);
+    peer->fd = fd;
+    peer->id = -1;
+    peer->seed = seed;
+    snprintf(peer->address, sizeof(peer->address), "%s", address);
+    peer->connecting = connecting;
+    atomic_init(&peer->failed, false);
+    peer->want_write = connecting;  // A non-blocking connect completes when the socket is writable
+    pthread_mutex_init(&peer->lock, NULL);
     
-    // Count nodes that have this block in their chain
-    for (int i = 0; i < node_count; i++) {
-        if (nodes[i].is_active) {
-            total_active++;
-            
-            pthread_mutex_lock(&nodes[i].chain->lock);
+    struct epoll_event event = { .events = EPOLLIN | (connecting ? EPOLLOUT : 0), .data.ptr = peer };
+    epoll_ctl(transport.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    
+    pthread_mutex_lock(&transport.peers_lock);
+    if (transport.peer_count == transport.peer_capacity) {
+        int capacity = transport.peer_capacity ? transport.peer_capacity * 2 : 8;
+        Peer** peers = realloc(transport.peers, capacity * sizeof(Peer*));
+        if (!peers) {
+            pthread_mutex_unlock(&transport.peers_lock);
+            close(fd);
+            pthread_mutex_destroy(&peer->lock);
+            free(peer);
+            return NULL;
+        }
+        transport.peers = peers;
+        transport.peer_capacity = capacity;
+    }
+    transport.peers[transport.peer_count++] = peer;
+    pthread_mutex_unlock(&transport.peers_lock);
+    
+    if (seed >= 0) transport.seed_connected[seed] = true;
+    return peer;
+}
+
+// Unregister and free a peer, transport thread only
+static void peer_close(Peer* peer) {
+    pthread_mutex_lock(&transport.peers_lock);
+    for (int i = 0; i < transport.peer_count; i++) {
+        if (transport.peers[i] == peer) {
+            transport.peers[i] = transport.peers[--transport.peer_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&transport.peers_lock);
+    
+    // Senders only touch a peer while holding peers_lock, so nobody can see it anymore
+    epoll_ctl(transport.epoll_fd, EPOLL_CTL_DEL, peer->fd, NULL);
+    close(peer->fd);
+    if (peer->seed >= 0) transport.seed_connected[peer->seed] = false;
+    if (peer->ready) printf("Node %d lost peer %s\n", transport.node->id, peer->address);
+    
+    buffer_free(&peer->input);
+    buffer_free(&peer->output);
+    pthread_mutex_destroy(&peer->lock);
+    free(peer);
+}
+
+// Close every peer marked as failed
+static void transport_close_failed(void) {
+    while (true) {
+        Peer* failed = NULL;
+        pthread_mutex_lock(&transport.peers_lock);
+        for (int i = 0; i < transport.peer_count && !failed; i++) {
+            if (atomic_load(&transport.peers[i]->failed)) failed = transport.peers[i];
+        }
+        pthread_mutex_unlock(&transport.peers_lock);
+        if (!failed) return;
+        peer_close(failed);
+    }
+}
+
+// Introduce ourselves: protocol version, node id, chain height and genesis block
+static void transport_send_hello(Peer* peer) {
+    Blockchain* chain = transport.node->chain;
+    ChainTip tip = get_chain_tip(chain);
+    chain_read_lock(chain);
+    Digest genesis = chain->by_height[0]->hash;
+    pthread_rwlock_unlock(&chain->lock);
+    
+    ByteBuffer frame = {0};
+    if (frame_begin(&frame, MSG_HELLO) &&
+        buffer_put_u32(&frame, WIRE_VERSION) &&
+        buffer_put_u32(&frame, (uint32_t)transport.node->id) &&
+        buffer_put_u32(&frame, (uint32_t)tip.height) &&
+        buffer_put(&frame, genesis.bytes, DIGEST_SIZE)) {
+        frame_end(&frame);
+        peer_send(peer, &frame);
+    }
+    buffer_free(&frame);
+}
+
+// Ask a peer for the blocks after the last block our chains share
+// The locator lists our hashes from the tip down, one apart at first and then
+// doubling the gap, and always ends with genesis, so a fork is found in O(log n) hashes
+static void transport_request_blocks(Peer* peer) {
+    Blockchain* chain = transport.node->chain;
+    Digest locator[LOCATOR_MAX];
+    int count = 0;
+    
+    chain_read_lock(chain);
+    int step = 1;
+    for (int h = chain->block_count - 1; h > 0 && count < LOCATOR_MAX - 1; h -= step) {
+        locator[count++] = chain->by_height[h]->hash;
+        if (count >= 8) step *= 2;
+    }
+    locator[count++] = chain->by_height[0]->hash;
+    pthread_rwlock_unlock(&chain->lock);
+    
+    ByteBuffer frame = {0};
+    bool ok = frame_begin(&frame, MSG_GET_BLOCKS) && buffer_put_u32(&frame, (uint32_t)count);
+    for (int i = 0; ok && i < count; i++) ok = buffer_put(&frame, locator[i].bytes, DIGEST_SIZE);
+    if (ok) {
+        frame_end(&frame);
+        peer_send(peer, &frame);
+        peer->sync_requested_ms = monotonic_ms();
+    }
+    buffer_free(&frame);
+}
+
+// Whether a block went through this process recently, remembers it if not
+static bool transport_seen_block(const Digest* hash) {
+    for (int i = 0; i < SEEN_BLOCKS; i++) {
+        if (digest_equal(&transport.seen[i], hash)) return true;
+    }
+    transport.seen[transport.seen_next] = *hash;
+    transport.seen_next = (transport.seen_next + 1) % SEEN_BLOCKS;
+    return false;
+}
+
+static bool handle_hello(Peer* peer, WireReader* reader) {
+    uint32_t version = wire_u32(reader);
+    uint32_t id = wire_u32(reader);
+    uint32_t height = wire_u32(reader);
+    const uint8_t* genesis = wire_bytes(reader, DIGEST_SIZE);
+    if (reader->failed || version != WIRE_VERSION) return false;
+    
+    Blockchain* chain = transport.node->chain;
+    chain_read_lock(chain);
+    bool same_network = memcmp(chain->by_height[0]->hash.bytes, genesis, DIGEST_SIZE) == 0;
+    pthread_rwlock_unlock(&chain->lock);
+    if (!same_network) {
+        printf("Node %d: peer %s has another genesis block, disconnecting\n", transport.node->id, peer->address);
+        return false;
+    }
+    
+    pthread_mutex_lock(&transport.peers_lock);
+    peer->id = (int)id;
+    peer->ready = true;
+    pthread_mutex_unlock(&transport.peers_lock);
+    printf("Node %d connected to peer %s (node %d, height %d)\n",
+           transport.node->id, peer->address, (int)id, (int)height);
+    
+    // Catch up right away if the peer is ahead
+    if ((int)height > get_chain_tip(chain).height) transport_request_blocks(peer);
+    return true;
+}
+
+static bool handle_block(Peer* peer, WireReader* reader) {
+    BlockPool* pool = &transport.node->chain->pool;  // Decoded blocks are working blocks of the local node
+    BlockView view;
+    if (!block_view_open(reader, &view)) return false;
+    
+    // Every peer relays each block, the copies we already saw and blocks that miss
+    // the target are dropped on the header hash without decoding their events
+    Digest hash;
+    block_view_hash(&view, &hash);
+    if (!hash_meets_bits(&hash, view.bits) || transport_seen_block(&hash)) return true;
+    
+    Block* block = decode_block_view(&view, pool);
+    if (!block) return false;
+    
+    // A block that fails validation is ignored, not relayed
+    if (!validate_block_events(block)) {
+        pool_free_block(pool, block);
+        return true;
+    }
+    
+    Blockchain* chain = transport.node->chain;
+    chain_read_lock(chain);
+    bool known = chain_knows_block(chain, &block->hash);
+    bool attaches = chain_knows_block(chain, &block->previous_hash);  // Side branches count
+    bool ahead = block->index >= chain->block_count;
+    pthread_rwlock_unlock(&chain->lock);
+    
+    if (known) {
+        pool_free_block(pool, block);
+    } else if (!attaches) {
+        // We missed blocks or are on a losing fork, the peer knows the way to this one
+        // While a request is on its way, its answer covers this block: a batch can be close to
+        // WIRE_MAX_FRAME, so one request per relayed block would fill the peer's output queue
+        bool requested = peer->sync_requested_ms && monotonic_ms() - peer->sync_requested_ms < SYNC_RETRY_MS;
+        if (ahead && !requested) transport_request_blocks(peer);
+        pool_free_block(pool, block);
+    } else {
+        Block* stored = block_publish(block);
+        pool_free_block(pool, block);
+        if (stored) {
+            deliver_block(stored, -1);       // To the local node(s)
+            peers_send_block(stored, peer);  // Gossip to the other peers
+            block_release(stored);
+        }
+    }
+    return true;
+}
+
+static bool handle_event(Peer* peer, WireReader* reader) {
+    int type = (int)wire_zigzag(reader);
+    uint64_t length = wire_varint(reader);
+    if (length > MAX_EVENT_DATA) return false;
+    const uint8_t* data = wire_bytes(reader, (size_t)length);
+    if (!data || memchr(data, 0, length)) return false;
+    
+    char* text = malloc((size_t)length + 1);
+    if (!text) return true;
+    memcpy(text, data, length);
+    text[length] = '\0';
+    
+    // Relay events we didn't have yet, the mempool refuses the ones already pending
+    if (add_blockchain_event(transport.node->chain, type, text)) {
+        ByteBuffer frame = {0};
+        if (frame_event(&frame, type, text)) peers_send_all(&frame, peer);
+        buffer_free(&frame);
+    }
+    free(text);
+    return true;
+}
+
+static bool handle_get_blocks(Peer* peer, WireReader* reader) {
+    uint32_t count = wire_u32(reader);
+    if (reader->failed || count == 0 || count > LOCATOR_MAX) return false;
+    Digest locator[LOCATOR_MAX];
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* hash = wire_bytes(reader, DIGEST_SIZE);
+        if (!hash) return false;
+        memcpy(locator[i].bytes, hash, DIGEST_SIZE);
+    }
+    
+    // Retain the blocks after the first locator hash we know, then encode them unlocked
+    Blockchain* chain = transport.node->chain;
+    Block* blocks[CHAIN_BATCH_BLOCKS];
+    int block_count = 0;
+    chain_read_lock(chain);
+    int start = chain->block_count;
+    for (uint32_t i = 0; i < count; i++) {
+        Block* shared = chain_find_block(chain, &locator[i]);
+        if (shared) {
+            start = shared->index + 1;
+            break;
+        }
+    }
+    for (int h = start; h < chain->block_count && block_count < CHAIN_BATCH_BLOCKS; h++) {
+        blocks[block_count++] = block_retain(chain->by_height[h]);
+    }
+    pthread_rwlock_unlock(&chain->lock);
+    
+    // Stop before the frame gets larger than the peer accepts, it asks again for the rest
+    ByteBuffer frame = {0};
+    bool ok = frame_begin(&frame, MSG_CHAIN) && buffer_put_u32(&frame, 0);
+    int sent = 0;
+    while (ok && sent < block_count &&
+           frame.length - 4 + encoded_block_size(blocks[sent]) <= WIRE_MAX_FRAME) {
+        ok = encode_block(&frame, blocks[sent++]);
+    }
+    if (ok) {
+        put_le32(frame.bytes + 5, (uint32_t)sent);  // Count after the length and type
+        frame_end(&frame);
+        peer_send(peer, &frame);
+    }
+    buffer_free(&frame);
+    for (int i = 0; i < block_count; i++) block_release(blocks[i]);
+    return true;
+}
+
+static bool handle_chain(Peer* peer, WireReader* reader) {
+    uint32_t count = wire_u32(reader);
+    if (reader->failed || count > CHAIN_BATCH_BLOCKS) return false;
+    peer->sync_requested_ms = 0;  // Answered
+    
+    // Every block must be valid and follow the one before it
+    BlockPool* pool = &transport.node->chain->pool;
+    Block* blocks[CHAIN_BATCH_BLOCKS];
+    int block_count = 0;
+    bool well_formed = true;
+    bool valid = true;
+    for (uint32_t i = 0; i < count && valid; i++) {
+        Block* block = decode_block(reader, pool);
+        if (!block) {
+            well_formed = valid = false;
+            break;
+        }
+        bool links = block_count == 0 ||
+                     (block->index == blocks[block_count - 1]->index + 1 &&
+                      digest_equal(&block->previous_hash, &blocks[block_count - 1]->hash));
+        valid = links && is_valid_proof(block) && validate_block_events(block);
+        Block* stored = valid ? block_publish(block) : NULL;
+        pool_free_block(pool, block);
+        if (stored) {
+            blocks[block_count++] = stored;
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid || block_count == 0) {
+        for (int i = 0; i < block_count; i++) block_release(blocks[i]);
+        return well_formed;
+    }
+    
+    // Add the blocks to our tree if they follow a block we have, the tip moves if they bring more work
+    Node* node = transport.node;
+    Blockchain* chain = node->chain;
+    chain_write_lock(chain);
+    Block* tip = chain->last_block;
+    BlockIndexEntry* parent = tree_find(chain, &blocks[0]->previous_hash);
+    int fetched = 0;
+    if (parent && blocks[0]->index == parent->block->index + 1) {
+        fetched = chain_adopt_locked(chain, parent->block->index, blocks, block_count);
+    } else {
+        for (int i = 0; i < block_count; i++) block_release(blocks[i]);
+    }
+    bool moved = chain->last_block != tip;
+    int length = chain->block_count;
+    pthread_rwlock_unlock(&chain->lock);
+    
+    if (moved) {
+        atomic_store(&node->mining_cancel, true);  // Its miner should move to the new tip
+        node_notify(node, NODE_EVENT_TIP);
+        printf("Node %d synchronized with peer %s (chain length: %d, %d blocks fetched)\n",
+               node->id, peer->address, length, fetched);
+        // The peer may have more: a batch stops at CHAIN_BATCH_BLOCKS or WIRE_MAX_FRAME,
+        // asking again costs one empty MSG_CHAIN once we have caught up
+        transport_request_blocks(peer);
+    }
+    return true;
+}
+
+// Apply one message from a peer
+// Returns false if the message is malformed, the peer is disconnected then
+static bool transport_handle_message(Peer* peer, uint8_t type, WireReader* reader) {
+    atomic_fetch_add(&transport.messages_in, 1);
+    if (!peer->ready && type != MSG_HELLO) return false;  // Must introduce itself first
+    switch (type) {
+        case MSG_HELLO:      return handle_hello(peer, reader);
+        case MSG_BLOCK:      return handle_block(peer, reader);
+        case MSG_EVENT:      return handle_event(peer, reader);
+        case MSG_GET_BLOCKS: return handle_get_blocks(peer, reader);
+        case MSG_CHAIN:      return handle_chain(peer, reader);
+        default:             return true;  // Unknown messages are skipped, for newer peers
+    }
+}
+
+// Read what a peer sent and handle every complete message, transport thread only
+static void peer_read(Peer* peer) {
+    ByteBuffer* input = &peer->input;
+    while (!atomic_load(&peer->failed)) {
+        if (!buffer_reserve(input, 64 * 1024)) {
+            peer_fail(peer);
+            return;
+        }
+        ssize_t received = recv(peer->fd, input->bytes + input->length, input->capacity - input->length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (received <= 0) {
+            peer_fail(peer);  // Closed by the other side or broken
+            return;
+        }
+        input->length += (size_t)received;
+        atomic_fetch_add(&transport.bytes_in, (unsigned long long)received);
+        
+        // Handle the complete messages now, so input never holds more than one partial message
+        size_t offset = 0;
+        while (input->length - offset >= 4) {
+            uint32_t length = get_le32(input->bytes + offset);
+            if (length == 0 || length > WIRE_MAX_FRAME) {
+                peer_fail(peer);
+                return;
+            }
+            if (input->length - offset - 4 < length) break;
             
-            // Check if node has this block
-            Block* current = nodes[i].chain->genesis;
-            while (current) {
-                if (strcmp(current->hash, block->hash) == 0) {
-                    nodes_with_block++;
-                    break;
+            WireReader reader = { input->bytes + offset + 5, length - 1, false };
+            if (!transport_handle_message(peer, input->bytes[offset + 4], &reader)) {
+                printf("Node %d: invalid message from peer %s, disconnecting\n", transport.node->id, peer->address);
+                peer_fail(peer);
+                return;
+            }
+            offset += 4 + (size_t)length;
+        }
+        memmove(input->bytes, input->bytes + offset, input->length - offset);
+        input->length -= offset;
+    }
+}
+
+// Accept every pending incoming connection
+static void transport_accept(void) {
+    while (true) {
+        struct sockaddr_storage address;
+        socklen_t address_length = sizeof(address);
+        int fd = accept(transport.listen_fd, (struct sockaddr*)&address, &address_length);
+        if (fd < 0) return;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        
+        char host[48], port[8], name[64];
+        if (getnameinfo((struct sockaddr*)&address, address_length, host, sizeof(host), port, sizeof(port),
+                        NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+            snprintf(host, sizeof(host), "?");
+            snprintf(port, sizeof(port), "?");
+        }
+        snprintf(name, sizeof(name), "%s:%s", host, port);
+        
+        Peer* peer = peer_create(fd, name, -1, false);
+        if (peer) transport_send_hello(peer);
+    }
+}
+
+// Start a non-blocking connection to a configured peer ("host:port")
+static void transport_dial(int seed) {
+    char host[64];
+    const char* address = transport.seeds[seed];
+    const char* colon = strrchr(address, ':');
+    if (!colon || colon == address || (size_t)(colon - address) >= sizeof(host)) return;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+    
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* result;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) return;
+    
+    int fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd >= 0) {
+        if (connect(fd, result->ai_addr, result->ai_addrlen) == 0) {
+            Peer* peer = peer_create(fd, address, seed, false);
+            if (peer) transport_send_hello(peer);
+        } else if (errno == EINPROGRESS) {
+            peer_create(fd, address, seed, true);  // Finished in the loop once writable
+        } else {
+            close(fd);  // Not up yet, retried after RECONNECT_INTERVAL_MS
+        }
+    }
+    freeaddrinfo(result);
+}
+
+// A non-blocking connect finished, successfully or not
+static void peer_connected(Peer* peer) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+        peer_fail(peer);
+        return;
+    }
+    pthread_mutex_lock(&peer->lock);
+    peer->connecting = false;
+    pthread_mutex_unlock(&peer->lock);
+    transport_send_hello(peer);
+    
+    // Flush also disarms EPOLLOUT once nothing is left to write
+    pthread_mutex_lock(&peer->lock);
+    peer_flush_locked(peer);
+    pthread_mutex_unlock(&peer->lock);
+}
+
+// Transport thread: the epoll loop
+void* transport_thread(void* arg) {
+    (void)arg;
+    metrics_name_thread("transport");
+    struct epoll_event events[64];
+    long long next_dial = 0;
+    
+    while (atomic_load(&transport.running)) {
+        // Keep a connection to every configured peer
+        long long now = monotonic_ms();
+        if (now >= next_dial) {
+            for (int s = 0; s < transport.seed_count; s++) {
+                if (!transport.seed_connected[s]) transport_dial(s);
+            }
+            next_dial = now + RECONNECT_INTERVAL_MS;
+        }
+        
+        int count = epoll_wait(transport.epoll_fd, events, 64, RECONNECT_INTERVAL_MS);
+        for (int i = 0; i < count; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &transport.wake_fd) {
+                uint64_t value;
+                if (read(transport.wake_fd, &value, sizeof(value)) < 0) {
+                    // Already drained
                 }
-                current = current->next;
+                continue;
+            }
+            if (tag == &transport.listen_fd) {
+                transport_accept();
+                continue;
             }
             
-            pthread_mutex_unlock(&nodes[i].chain->lock);
+            // Failed peers stay registered until the end of this round, so tags stay valid
+            Peer* peer = tag;
+            if (atomic_load(&peer->failed)) continue;
+            if (peer->connecting) {
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) peer_connected(peer);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) peer_read(peer);
+            if ((events[i].events & EPOLLOUT) && !atomic_load(&peer->failed)) {
+                pthread_mutex_lock(&peer->lock);
+                peer_flush_locked(peer);
+                pthread_mutex_unlock(&peer->lock);
+            }
+        }
+        transport_close_failed();
+    }
+    return NULL;
+}
+
+// Connect the local node to other processes: listen on port (0 = only dial out)
+// and keep a connection to each of the seed addresses ("host:port")
+// Returns false if the sockets or the loop thread could not be set up
+bool transport_start(Node* node, int port, char** seeds, int seed_count) {
+    transport.node = node;
+    transport.seeds = seeds;
+    transport.seed_count = seed_count;
+    transport.seed_connected = calloc(seed_count ? seed_count : 1, sizeof(bool));
+    transport.epoll_fd = epoll_create1(0);
+    transport.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (!transport.seed_connected || transport.epoll_fd < 0 || transport.wake_fd < 0) return false;
+    
+    struct epoll_event wake = { .events = EPOLLIN, .data.ptr = &transport.wake_fd };
+    epoll_ctl(transport.epoll_fd, EPOLL_CTL_ADD, transport.wake_fd, &wake);
+    
+    if (port > 0) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port),
+                                       .sin_addr.s_addr = htonl(INADDR_ANY) };
+        if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+            fprintf(stderr, "Cannot listen on port %d: %s\n", port, strerror(errno));
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        transport.listen_fd = fd;
+        struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = &transport.listen_fd };
+        epoll_ctl(transport.epoll_fd, EPOLL_CTL_ADD, fd, &listen_event);
+    }
+    
+    atomic_store(&transport.running, true);
+    if (pthread_create(&transport.thread, NULL, transport_thread, NULL) != 0) {
+        atomic_store(&transport.running, false);
+        return false;
+    }
+    return true;
+}
+
+// Stop the loop thread and close every connection
+// The local node must be stopped first, it may still be broadcasting otherwise
+void transport_stop(void) {
+    if (atomic_exchange(&transport.running, false)) {
+        uint64_t one = 1;
+        if (write(transport.wake_fd, &one, sizeof(one)) < 0) {
+            // The loop wakes up on its timeout anyway
         }
+        pthread_join(transport.thread, NULL);
     }
     
-    pthread_mutex_unlock(&nodes_lock);
+    pthread_mutex_lock(&transport.peers_lock);
+    for (int i = 0; i < transport.peer_count; i++) atomic_store(&transport.peers[i]->failed, true);
+    pthread_mutex_unlock(&transport.peers_lock);
+    transport_close_failed();
+    free(transport.peers);
+    transport.peers = NULL;
+    transport.peer_capacity = 0;
     
-    // Check if consensus threshold is met (typically >50%)
-    return (float)nodes_with_block / total_active >= CONSENSUS_THRESHOLD;
+    if (transport.listen_fd >= 0) close(transport.listen_fd);
+    if (transport.wake_fd >= 0) close(transport.wake_fd);
+    if (transport.epoll_fd >= 0) close(transport.epoll_fd);
+    transport.listen_fd = transport.wake_fd = transport.epoll_fd = -1;
+    free(transport.seed_connected);
+    transport.seed_connected = NULL;
+}
+
+// Submit a transaction to the local node and relay it to every peer
+// Returns 1 if queued, 0 if it was already pending or the mempool is full
+int transport_submit_event(int type, const char* data) {
+    int result = add_blockchain_event(transport.node->chain, type, data);
+    if (result && atomic_load(&transport.running)) {
+        ByteBuffer frame = {0};
+        if (frame_event(&frame, type, data)) peers_send_all(&frame, NULL);
+        buffer_free(&frame);
+    }
+    return result;
+}
+
+/*
+ * CONSENSUS FUNCTIONS
+ * Determine agreement across the network
+ */
+
+// Check if majority of active nodes have a particular block (consensus)
+// This is how we determine if a block is accepted by the network
+// The tracker already knows who holds what, see CONSENSUS TRACKER
+bool check_consensus(Block* block) {
+    return consensus_reached(&block->hash);
 }
 
 /*
@@ -866,18 +5849,27 @@ bool check_consensus(Block* block) {
 void print_block(Block* block) {
     printf("Block #%d\n", block->index);
     printf("Time: %s", ctime(&block->timestamp));
-    printf("Previous hash: %s\n", block->previous_hash);
-    printf("Merkle root: %s\n", block->merkle_root);
-    printf("Block hash: %s\n", block->hash);
+    char hex[HASH_SIZE+1];
+    digest_to_hex(&block->previous_hash, hex);
+    printf("Previous hash: %s\n", hex);
+    digest_to_hex(&block->merkle_root, hex);
+    printf("Merkle root: %s\n", hex);
+    digest_to_hex(&block->hash, hex);
+    printf("Block hash: %s\n", hex);
     printf("Nonce: %d\n", block->nonce);
+    printf("Target: %08x (difficulty %.0f)\n", block->bits, difficulty_from_bits(block->bits));
     printf("Events: %d\n", block->event_count);
     
     // Print all events in the block
     for (int i = 0; i < block->event_count; i++) {
-        printf("  [%d] Type: %d | Valid: %s | Data: %s\n", 
-               i+1, block->events[i].type, 
-               block->events[i].is_valid ? "Yes" : "No", 
-               block->events[i].data);
+        Event event = get_event(block, i);
+        char time_text[30];
+        struct tm local;
+        strftime(time_text, sizeof(time_text), "%Y-%m-%d %H:%M:%S", localtime_r(&event.timestamp, &local));
+        printf("  [%d] Type: %d | Valid: %s | Time: %s | Data: %s\n", 
+               i+1, event.type, 
+               event.is_valid ? "Yes" : "No", 
+               time_text, event.data);
     }
     printf("\n");
 }
@@ -885,42 +5877,64 @@ void print_block(Block* block) {
 
 // Print the entire blockchain
 void print_blockchain(Blockchain* chain) {
-    pthread_mutex_lock(&chain->lock);
+    chain_read_lock(chain);
     
     printf("=== BLOCKCHAIN (%d blocks) ===\n\n", chain->block_count);
     
-    // Print each confirmed block
-    Block* current = chain->genesis;
-    while (current) {
-        print_block(current);
-        current = current->next;
+    // Print each confirmed block, in height order
+    for (int h = 0; h < chain->block_count; h++) {
+        print_block(chain_block_at(chain, h));
     }
     
     // Print the block currently being mined
     printf("=== MINING BLOCK ===\n");
-    print_block(chain->current_mining_block);
+    if (chain->current_mining_block) print_block(chain->current_mining_block);
+    printf("Pending transactions: %d\n\n", atomic_load(&chain->mempool.pending));
+    
+    pthread_rwlock_unlock(&chain->lock);
+}
+
+// Print how much space a chain takes encoded (wire and block log) versus in memory
+void print_chain_encoding(Blockchain* chain) {
+    ByteBuffer buffer = {0};
+    size_t encoded = 0;
+    size_t in_memory = 0;
+    int events = 0;
+    
+    chain_read_lock(chain);
+    for (int h = 0; h < chain->block_count; h++) {
+        Block* block = chain_block_at(chain, h);
+        buffer.length = 0;
+        if (encode_block(&buffer, block)) encoded += buffer.length;
+        in_memory += block_memory_size(block);
+        events += block->event_count;
+    }
+    int block_count = chain->block_count;
+    pthread_rwlock_unlock(&chain->lock);
+    buffer_free(&buffer);
     
-    pthread_mutex_unlock(&chain->lock);
+    printf("Chain encoding: %d blocks, %d events, %zu bytes encoded vs %zu bytes in memory (%.1fx smaller)\n",
+           block_count, events, encoded, in_memory, encoded ? (double)in_memory / encoded : 0.0);
 }
 
 // Print status information for a specific node
 void print_node_status(int node_id) {
-    pthread_mutex_lock(&nodes_lock);
+    nodes_read_lock();
     
     if (node_id < 0 || node_id >= node_count) {
         printf("Invalid node ID\n");
-        pthread_mutex_unlock(&nodes_lock);
+        pthread_rwlock_unlock(&nodes_lock);
         return;
     }
     
-    Node* node = &nodes[node_id];
+    Node* node = nodes[node_id];
     
     printf("=== NODE %d ===\n", node->id);
-    printf("Status: %s\n", node->is_active ? "Active" : "Inactive");
+    printf("Status: %s\n", atomic_load(&node->is_active) ? "Active" : "Inactive");
     printf("Role: %s\n", node->is_mining ? "Miner" : "Validator");
     printf("Behavior: %s\n\n", node->is_malicious ? "Malicious" : "Honest");
     
-    pthread_mutex_unlock(&nodes_lock);
+    pthread_rwlock_unlock(&nodes_lock);
     
     print_blockchain(node->chain);
 }
@@ -940,21 +5954,113 @@ void test_nominal_operations() {
     create_blockchain_node(false, false); // Node 2: validator only
     
     // Add some transactions
-    add_blockchain_event(nodes[0].chain, 1, "{\"from\":\"Alice\",\"to\":\"Bob\",\"amount\":10}");
+    add_blockchain_event(nodes[0]->chain, 1, "{\"from\":\"Alice\",\"to\":\"Bob\",\"amount\":10}");
     sleep(1);  // Give time for propagation
     
-    add_blockchain_event(nodes[1].chain, 1, "{\"from\":\"Bob\",\"to\":\"Carol\",\"amount\":5}");
+    add_blockchain_event(nodes[1]->chain, 1, "{\"from\":\"Bob\",\"to\":\"Carol\",\"amount\":5}");
+    sleep(1);  // Give time for propagation
+    
+    // A batch is queued at once, so it ends up in a block with several events (used by the light client below)
+    EventInput batch[] = {
+        { 1, "{\"from\":\"Carol\",\"to\":\"Dave\",\"amount\":3}" },
+        { 1, "{\"from\":\"Dave\",\"to\":\"Erin\",\"amount\":2}" },
+        { 1, "{\"from\":\"Erin\",\"to\":\"Frank\",\"amount\":1}" },
+        { 1, "{\"from\":\"Frank\",\"to\":\"Alice\",\"amount\":4}" },
+        { 1, "{\"from\":\"Alice\",\"to\":\"Carol\",\"amount\":6}" },
+    };
+    add_blockchain_events(nodes[0]->chain, batch, sizeof(batch) / sizeof(batch[0]));
     sleep(1);  // Give time for propagation
     
     print_node_status(0);
+    print_chain_encoding(nodes[0]->chain);
     
     // Check if transactions have propagated
-    Block* latest_block_node0 = get_latest_block(nodes[0].chain);
+    Block* latest_block_node0 = get_latest_block(nodes[0]->chain);
     if (check_consensus(latest_block_node0)) {
         printf("TEST 1 PASSED: Consensus achieved on latest block\n");
     } else {
         printf("TEST 1 FAILED: No consensus on latest block\n");
     }
+    block_release(latest_block_node0);
+    
+    // Read-only validator: node 2 checks a transaction mined by node 0 with only
+    // a Merkle proof and its own copy of the block header, without the other events
+    // The block with the most events has the longest proof, wait a little if the batch isn't mined yet
+    Block* mined = NULL;
+    for (int tries = 0; tries < 30 && !mined; tries++) {
+        chain_read_lock(nodes[0]->chain);
+        for (int h = 1; h < nodes[0]->chain->block_count; h++) {
+            Block* block = chain_block_at(nodes[0]->chain, h);
+            if (block->event_count > 1 && (!mined || block->event_count > mined->event_count)) mined = block;
+        }
+        if (mined) block_retain(mined);  // Node 0 may reorganize once the lock is released
+        pthread_rwlock_unlock(&nodes[0]->chain->lock);
+        if (!mined) usleep(100000);
+    }
+    
+    // Prove the last event, on an odd level it is paired with itself
+    Event event;
+    MerkleProof proof;
+    int event_index = mined ? mined->event_count - 1 : 0;
+    bool have_proof = mined && get_event_proof(mined, event_index, &proof);
+    Digest block_hash;
+    char* data = NULL;
+    if (have_proof) {
+        // Keep our own copy of the payload, the light client doesn't read node 0's memory
+        event = get_event(mined, event_index);
+        data = strdup(event.data);
+        event.data = data;
+        block_hash = mined->hash;
+    }
+    
+    if (have_proof) {
+        chain_read_lock(nodes[2]->chain);
+        Block* header = chain_find_block(nodes[2]->chain, &block_hash);
+        bool verified = header && verify_event_proof(&event, &proof, &header->merkle_root);
+        pthread_rwlock_unlock(&nodes[2]->chain->lock);
+        
+        if (!header) {
+            printf("Node 2 doesn't have block %d of node 0, nothing to verify against\n", mined->index);
+        } else {
+            printf("Node 2 %s event %d of %d \"%s\" in block %d with a proof of %d hashes\n",
+                   verified ? "verified" : "could not verify", event_index + 1, mined->event_count,
+                   event.data, mined->index, proof.length);
+        }
+    } else {
+        printf("Node 2: no block with several transactions to verify yet\n");
+    }
+    if (mined) block_release(mined);
+    free(data);
+}
+
+// Verifier check on a chain of our own, so no node thread changes it meanwhile: forge an event
+// at height 2 of a verified chain, both verifiers must find it there and the checkpoint must drop below it
+static bool check_tamper_detection(void) {
+    Blockchain* chain = create_blockchain();
+    if (!chain) return false;
+    char data[64];
+    for (int h = 1; h <= 4; h++) {
+        snprintf(data, sizeof(data), "{\"from\":\"Alice\",\"to\":\"Bob\",\"amount\":%d}", h);
+        add_blockchain_event(chain, 1, data);
+        confirm_block(chain);
+    }
+    bool valid_before = verify_chain_incremental(chain, NULL) < 0;
+    
+    chain_write_lock(chain);
+    int checkpoint_before = chain->checkpoint_height;
+    bool forged = forge_block_event(chain, 2);
+    int checkpoint_after = chain->checkpoint_height;
+    pthread_rwlock_unlock(&chain->lock);
+    
+    int full = verify_chain(chain, NULL);
+    int incremental = verify_chain_incremental(chain, NULL);
+    bool detected = valid_before && forged && full == 2 && incremental == 2 &&
+                    checkpoint_before == 4 && checkpoint_after < 2;
+    printf("Tamper check: event forged at height 2, verify_chain %d, verify_chain_incremental %d, "
+           "checkpoint %d -> %d: %s\n", full, incremental, checkpoint_before, checkpoint_after,
+           detected ? "detected" : "NOT DETECTED");
+    free_blockchain(chain);
+    return detected;
 }
 
 // Test unauthorized modifications to the blockchain
@@ -970,15 +6076,33 @@ void test_unauthorized_modifications() {
     // Check if malicious changes were accepted
     bool malicious_consensus = false;
     
-    pthread_mutex_lock(&nodes[3].chain->lock);
-    Block* malicious_block = nodes[3].chain->genesis->next;  // First non-genesis block
-    pthread_mutex_unlock(&nodes[3].chain->lock);
+    chain_read_lock(nodes[3]->chain);
+    Block* malicious_block = chain_block_at(nodes[3]->chain, 1);  // First non-genesis block
+    if (malicious_block) block_retain(malicious_block);  // Node 3 may resync meanwhile
+    pthread_rwlock_unlock(&nodes[3]->chain->lock);
     
     if (malicious_block) {
         malicious_consensus = check_consensus(malicious_block);
+        block_release(malicious_block);
+    }
+    
+    // Re-verify chains from scratch: a tampered event no longer matches its block's Merkle root
+    int checked[] = { 0, 3 };  // An honest miner and the malicious one
+    for (int i = 0; i < 2; i++) {
+        int id = checked[i];
+        ChainVerification report;
+        int first_invalid = verify_chain(nodes[id]->chain, &report);
+        if (first_invalid < 0) {
+            printf("Chain of node %d verified: %d blocks, %d events in %.3fs\n",
+                   id, report.blocks, report.events, report.seconds);
+        } else {
+            printf("Chain of node %d is invalid from height %d\n", id, first_invalid);
+        }
     }
     
-    if (!malicious_consensus) {
+    bool detected = check_tamper_detection();
+    
+    if (!malicious_consensus && detected) {
         printf("TEST 2 PASSED: Unauthorized modifications rejected\n");
     } else {
         printf("TEST 2 FAILED: Unauthorized modifications accepted\n");
@@ -1001,8 +6125,8 @@ void test_majority_attack() {
     sleep(3);
     
     // Check if malicious chain is accepted
-    int honest_chain_length = nodes[0].chain->block_count;
-    int malicious_chain_length = nodes[3].chain->block_count;
+    int honest_chain_length = get_chain_tip(nodes[0]->chain).height + 1;
+    int malicious_chain_length = get_chain_tip(nodes[3]->chain).height + 1;
     
     printf("Honest chain length: %d\n", honest_chain_length);
     printf("Malicious chain length: %d\n", malicious_chain_length);
@@ -1022,20 +6146,20 @@ void test_availability() {
     stop_node(0);
     
     // Add transaction to remaining node
-    add_blockchain_event(nodes[1].chain, 1, "{\"from\":\"Dave\",\"to\":\"Eve\",\"amount\":15}");
+    add_blockchain_event(nodes[1]->chain, 1, "{\"from\":\"Dave\",\"to\":\"Eve\",\"amount\":15}");
     
     // Wait for propagation
     sleep(2);
     
     // Check blockchain state
-    int chain_length_before = nodes[1].chain->block_count;
+    int chain_length_before = get_chain_tip(nodes[1]->chain).height + 1;
     
     // Restart node
     start_node(0);
     sleep(2); // Give time for synchronization
     
     // Check if restarted node caught up
-    int chain_length_after = nodes[0].chain->block_count;
+    int chain_length_after = get_chain_tip(nodes[0]->chain).height + 1;
     
     printf("Chain length before restart: %d\n", chain_length_before);
     printf("Chain length after restart: %d\n", chain_length_after);
@@ -1052,10 +6176,183 @@ void test_availability() {
  * Entry point for the blockchain simulation
  */
 
-int main() {
+static void handle_stop_signal(int signal_number) {
+    (void)signal_number;
+    stop_signal = 1;
+}
+
+// Run this process as one node of a network spread over several processes or hosts
+// Mines unless validator_only, submits a demo transaction every second and prints
+// its tip every 5 seconds, until SIGINT/SIGTERM or until duration seconds (0 = no limit)
+int run_network_node(int port, char** seeds, int seed_count, bool validator_only, int duration) {
+    genesis_timestamp = NETWORK_GENESIS_TIME;  // Every process must build the same genesis block
+    data_resume = true;  // A restarted process continues from its --data-dir, peers only send the tail
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+    
+    Node* node = create_blockchain_node(!validator_only, false);
+    if (!node) return 1;
+    int status = 0;
+    if (!transport_start(node, port, seeds, seed_count)) {
+        fprintf(stderr, "Could not start the network transport\n");
+        status = 1;
+    } else {
+        printf("Node %d running (%s), listening on port %d, %d peer address(es)\n",
+               node->id, validator_only ? "validator" : "miner", port, seed_count);
+        for (int second = 0; !stop_signal && (duration <= 0 || second < duration); second++) {
+            sleep(1);
+            
+            // Unique per process, so every node contributes transactions
+            char data[128];
+            snprintf(data, sizeof(data), "{\"from\":\"%d\",\"to\":\"Peers\",\"amount\":%d}",
+                     (int)getpid(), second + 1);
+            transport_submit_event(1, data);
+            
+            if ((second + 1) % 5 == 0) {
+                ChainTip tip = get_chain_tip(node->chain);
+                char hash_hex[HASH_SIZE+1];
+                digest_to_hex(&tip.hash, hash_hex);
+                pthread_mutex_lock(&transport.peers_lock);
+                int peers = transport.peer_count;
+                pthread_mutex_unlock(&transport.peers_lock);
+                printf("Node %d at height %d (%s), %d peers\n", node->id, tip.height, hash_hex, peers);
+            }
+        }
+    }
+    
+    // The node goes first, it may be broadcasting through the transport
+    printf("\n=== SHUTTING DOWN NODE ===\n");
+    atomic_store(&shutdown_requested, true);
+    node_notify(node, NODE_EVENT_STOP);
+    pthread_join(node->thread, NULL);
+    transport_stop();
+    
+    printf("Transport: %llu messages in, %llu out, %llu bytes in, %llu bytes out\n",
+           (unsigned long long)atomic_load(&transport.messages_in),
+           (unsigned long long)atomic_load(&transport.messages_out),
+           (unsigned long long)atomic_load(&transport.bytes_in),
+           (unsigned long long)atomic_load(&transport.bytes_out));
+    ChainTip tip = get_chain_tip(node->chain);
+    char hash_hex[HASH_SIZE+1];
+    digest_to_hex(&tip.hash, hash_hex);
+    printf("Node %d final height %d (%s), %d pending transactions\n", node->id, tip.height, hash_hex,
+           atomic_load(&node->chain->mempool.pending));
+    printf("Node %d block tree: %zu side blocks, %d orphans, %llu reorgs (deepest %d blocks)\n",
+           node->id, node->chain->side.count, node->chain->orphan_count,
+           node->chain->reorgs, node->chain->deepest_reorg);
+    BlockPool* pool = &node->chain->pool;
+    printf("Node %d block pool: %llu blocks reused, %llu allocated, %llu recycled, %llu freed\n",
+           node->id, pool->reused, pool->allocated, pool->recycled, pool->freed);
+    free_node_registry();
+    mining_pool_stop();
+    consensus_tracker_free();
+    block_store_free(&block_store);
+    return status;
+}
+
+// benchmark.c includes this file with BLOCKCHAIN_NO_MAIN defined and brings its own main
+#ifndef BLOCKCHAIN_NO_MAIN
+unsigned long long finalized_reported = 0;  // Notifications the simulation got, see report_finalized
+
+// Finality listener of the simulation, called by consensus_deliver_finalized (one call at a time)
+static void report_finalized(const FinalizedBlock* block) {
+    finalized_reported++;
+    if (!log_blocks) return;
+    char hash_hex[HASH_SIZE+1];
+    digest_to_hex(&block->hash, hash_hex);
+    printf("Block %d finalized, held by %d of %d nodes: %s\n", block->height, block->holders, block->members,
+           hash_hex);
+}
+
+int main(int argc, char** argv) {
     srand(time(NULL));  // Initialize random number generator
     
+    // Command line options
+    //   --real          mine with the worker pool only (default)
+    //   --simulate      throttle mining and allow random early exits (old demo behaviour)
+    //   --threads N     number of mining workers per node (default: one per core)
+    //   --listen PORT   run as one node of a multi-process network, accepting peers on PORT
+    //   --peer HOST:PORT  connect to a node of that network (repeatable)
+    //   --validator     in network mode, validate and relay without mining
+    //   --duration S    in network mode, stop after S seconds (default: at SIGINT/SIGTERM)
+    //   --data-dir DIR  keep every chain on disk in DIR (network mode resumes from it)
+    //   --difficulty N  expected hashes per block (default 256), the lowest difficulty with --block-time
+    //   --max-events N  maximum events per block (default 100)
+    //   --block-time MS retarget the difficulty every --retarget-interval blocks towards MS per block
+    //   --retarget-interval N  blocks between two retargets (default 64)
+    //   --consensus F   share of active nodes that must hold a block for consensus (default 0.51)
+    //   --metrics S     print a metrics snapshot every S seconds (one is always printed at exit)
+    //   --trace FILE    write Chrome trace events (mining jobs, syncs, lock waits...) to FILE
+    //   --quiet         don't print a line per mined block
+    int listen_port = 0;
+    char** seeds = NULL;
+    int seed_count = 0;
+    bool validator_only = false;
+    int duration = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--real") == 0) {
+            simulation_mode = false;
+        } else if (strcmp(argv[i], "--simulate") == 0) {
+            simulation_mode = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            mining_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            listen_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--peer") == 0 && i + 1 < argc) {
+            if (!seeds) seeds = calloc(argc, sizeof(char*));
+            seeds[seed_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--validator") == 0) {
+            validator_only = true;
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--data-dir") == 0 && i + 1 < argc) {
+            data_dir = argv[++i];
+            if (mkdir(data_dir, 0755) != 0 && errno != EEXIST) {
+                fprintf(stderr, "Cannot create %s: %s\n", data_dir, strerror(errno));
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--difficulty") == 0 && i + 1 < argc) {
+            chain_params.difficulty = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-events") == 0 && i + 1 < argc) {
+            chain_params.max_events = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--block-time") == 0 && i + 1 < argc) {
+            chain_params.target_block_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--retarget-interval") == 0 && i + 1 < argc) {
+            chain_params.retarget_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--consensus") == 0 && i + 1 < argc) {
+            chain_params.consensus_threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metrics.interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            metrics.trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            log_blocks = false;
+        } else {
+            fprintf(stderr, "Usage: %s [--real | --simulate] [--threads N]\n"
+                            "       [--listen PORT] [--peer HOST:PORT ...] [--validator] [--duration S]\n"
+                            "       [--data-dir DIR] [--difficulty N] [--max-events N]\n"
+                            "       [--block-time MS] [--retarget-interval N] [--consensus F]\n"
+                            "       [--metrics S] [--trace FILE] [--quiet]\n", argv[0]);
+            free(seeds);
+            return 1;
+        }
+    }
+    if (!chain_params_apply(&chain_params) || !metrics_start()) {
+        free(seeds);
+        return 1;
+    }
+    
+    // With a port or a peer, this process is one node of a real network instead of the test suite
+    if (listen_port > 0 || seed_count > 0) {
+        int status = run_network_node(listen_port, seeds, seed_count, validator_only, duration);
+        free(seeds);
+        metrics_stop();
+        metrics_free();
+        return status;
+    }
+    
     // Run the test suite
+    consensus.on_finalized = report_finalized;
     test_nominal_operations();
     test_unauthorized_modifications();
     test_majority_attack();
@@ -1063,16 +6360,48 @@ int main() {
     
     // Cleanup
     printf("\n=== SHUTTING DOWN BLOCKCHAIN ===\n");
-    shutdown_requested = true;
+    atomic_store(&shutdown_requested, true);
+    for (int i = 0; i < node_count; i++) {
+        node_notify(nodes[i], NODE_EVENT_STOP);  // Idle validators sleep without a timer
+    }
     
-    // Wait for threads to finish
+    // Wait for threads to finish, all of them before freeing anything:
+    // a running node may still read or broadcast to the others
+    for (int i = 0; i < active_count; i++) {
+        pthread_join(active_nodes[i]->thread, NULL);
+    }
     for (int i = 0; i < node_count; i++) {
-        if (nodes[i].is_active) {
-            pthread_join(nodes[i].thread, NULL);
+        Node* node = nodes[i];
+        printf("Node %d inbox: %llu blocks delivered, %llu dropped\n", node->id,
+               (unsigned long long)atomic_load(&node->inbox.delivered),
+               (unsigned long long)atomic_load(&node->inbox.dropped));
+        printf("Node %d block tree: %zu side blocks, %d orphans, %llu reorgs (deepest %d blocks)\n",
+               node->id, node->chain->side.count, node->chain->orphan_count,
+               node->chain->reorgs, node->chain->deepest_reorg);
+        BlockPool* pool = &node->chain->pool;
+        printf("Node %d block pool: %llu blocks reused, %llu allocated, %llu recycled, %llu freed\n",
+               node->id, pool->reused, pool->allocated, pool->recycled, pool->freed);
+        if (node->is_mining) {
+            printf("Node %d mining: %llu jobs cancelled early (%llu hashes), %llu stale blocks discarded\n",
+                   node->id,
+                   (unsigned long long)atomic_load(&node->cancelled_jobs),
+                   (unsigned long long)atomic_load(&node->cancelled_hashes),
+                   (unsigned long long)atomic_load(&node->stale_blocks));
         }
-        free_blockchain(nodes[i].chain);
     }
+    consensus_deliver_finalized();  // Blocks finalized by the last blocks applied
+    printf("Consensus: %llu blocks finalized (highest at height %d, %llu reported), %zu blocks tracked\n",
+           consensus.finalized, consensus.finalized_height, finalized_reported, consensus.count);
+    metrics_stop();
+    free_node_registry();
+    printf("Block store: %ld blocks published, %ld still referenced\n",
+           block_store.total_blocks, block_store.live_blocks);
+    mining_pool_stop();
+    consensus_tracker_free();
+    block_store_free(&block_store);
+    metrics_free();
     
     printf("Blockchain simulation completed\n");
     return 0;
-}
\ No newline at end of file
+}
+#endif  // BLOCKCHAIN_NO_MAIN